@@ -0,0 +1,290 @@
+#include "mavalloc_arena.hpp"
+#include "mavalloc_pmr.hpp"
+#include "tinytest.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+using namespace mavalloc;
+
+typedef size_classes<16, 32, 64, 256> small_classes;
+
+// Rounding is resolved at compile time
+static_assert( Arena<first_fit, 4, small_classes>::round( 1 )   == 16,  "class 16" );
+static_assert( Arena<first_fit, 4, small_classes>::round( 17 )  == 32,  "class 32" );
+static_assert( Arena<first_fit, 4, small_classes>::round( 100 ) == 256, "class 256" );
+static_assert( Arena<first_fit, 4, small_classes>::round( 257 ) == 260, "aligned only" );
+static_assert( Arena<first_fit, 16>::round( 17 ) == 32, "alignment 16" );
+
+/*
+*
+* TEST CASE 1: Test first fit splitting and reuse
+*
+*/
+int test_case_1( const char * )
+{
+  default_arena arena( 65536 );
+
+  char * ptr1 = ( char * ) arena.allocate( 10000 );
+  char * ptr2 = ( char * ) arena.allocate( 65 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_EQUAL( arena.size(), 3 );
+
+  arena.deallocate( ptr1 );
+  char * ptr3 = ( char * ) arena.allocate( 5000 );
+
+  // First fit takes the hole ptr1 left at the front
+  TINYTEST_EQUAL( ptr1, ptr3 );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 2: Test coalescing back to a single node
+*
+*/
+int test_case_2( const char * )
+{
+  default_arena arena( 4096 );
+
+  void * ptr1 = arena.allocate( 100 );
+  void * ptr2 = arena.allocate( 100 );
+  void * ptr3 = arena.allocate( 100 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+
+  arena.deallocate( ptr1 );
+  arena.deallocate( ptr3 );
+  arena.deallocate( ptr2 );
+
+  TINYTEST_EQUAL( arena.size(), 1 );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 3: Test best and worst fit pick opposite holes
+*
+*/
+template <class Policy>
+static int pick_hole( char ** small_hole, char ** large_hole, char ** picked )
+{
+  Arena<Policy> arena( 8192 );
+
+  *large_hole   = ( char * ) arena.allocate( 2000 );
+  char * guard1 = ( char * ) arena.allocate( 4 );
+  *small_hole   = ( char * ) arena.allocate( 500 );
+  char * guard2 = ( char * ) arena.allocate( 4 );
+  char * rest   = ( char * ) arena.allocate( 8192 - 2600 );
+
+  if( !*large_hole || !guard1 || !*small_hole || !guard2 || !rest )
+  {
+    return 0;
+  }
+
+  arena.deallocate( *large_hole );
+  arena.deallocate( *small_hole );
+  *picked = ( char * ) arena.allocate( 400 );
+  return 1;
+}
+
+int test_case_3( const char * )
+{
+  char * small_hole;
+  char * large_hole;
+  char * picked;
+
+  TINYTEST_ASSERT( pick_hole<best_fit>( &small_hole, &large_hole, &picked ) );
+  TINYTEST_EQUAL( picked, small_hole );
+
+  TINYTEST_ASSERT( pick_hole<worst_fit>( &small_hole, &large_hole, &picked ) );
+  TINYTEST_EQUAL( picked, large_hole );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 4: Test next fit resumes after the previous allocation
+*
+*/
+int test_case_4( const char * )
+{
+  Arena<next_fit> arena( 4096 );
+
+  char * ptr1 = ( char * ) arena.allocate( 1000 );
+  char * ptr2 = ( char * ) arena.allocate( 1000 );
+  char * ptr3 = ( char * ) arena.allocate( 500 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+
+  arena.deallocate( ptr1 );
+  char * ptr4 = ( char * ) arena.allocate( 100 );
+
+  // The hole at ptr1 is skipped in favour of the space after ptr3
+  TINYTEST_ASSERT( ptr4 > ptr3 );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 5: Test alignment and running out of memory
+*
+*/
+int test_case_5( const char * )
+{
+  Arena<first_fit, 64> arena( 1024 );
+
+  void * ptr1 = arena.allocate( 1 );
+  void * ptr2 = arena.allocate( 1 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr1 % 64, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr2 % 64, 0 );
+
+  TINYTEST_EQUAL( arena.allocate( 4096 ), NULL );
+
+  // Sizes that would wrap when rounded up fail instead of coming back tiny
+  TINYTEST_EQUAL( arena.allocate( SIZE_MAX ), NULL );
+  TINYTEST_EQUAL( arena.allocate( SIZE_MAX - 70 ), NULL );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 6: Test the general pmr resource and its padded alignments
+*
+*/
+int test_case_6( const char * )
+{
+  mavalloc::arena heap( 65536 );
+  arena_resource resource;
+  arena_resource other;
+  monotonic_arena_resource monotonic;
+
+  void * ptr1 = resource.allocate( 10, 4 );
+  void * ptr2 = resource.allocate( 10, 8 );
+  void * ptr3 = resource.allocate( 100, 16 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr2 % 8, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr3 % 16, 0 );
+
+  // Memory from one arena_resource can go back through another
+  TINYTEST_ASSERT( resource.is_equal( other ) );
+  TINYTEST_ASSERT( !resource.is_equal( monotonic ) );
+
+  other.deallocate( ptr1, 10, 4 );
+  other.deallocate( ptr2, 10, 8 );
+  resource.deallocate( ptr3, 100, 16 );
+
+  // If you failed here a padded block was not given back whole
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 7: Test the monotonic pmr resource grows and releases its chunks
+*
+*/
+int test_case_7( const char * )
+{
+  mavalloc::arena heap( 65536 );
+  monotonic_arena_resource resource( 64 );
+  monotonic_arena_resource other;
+
+  // Push the chunks off 8 byte alignment, as mavalloc only promises 4
+  void * odd = mavalloc_alloc( 4 );
+  TINYTEST_ASSERT( odd );
+
+  char * ptr1 = ( char * ) resource.allocate( 3, 1 );
+  char * ptr2 = ( char * ) resource.allocate( 8, 8 );
+  char * ptr3 = ( char * ) resource.allocate( 24, 16 );
+
+  // Bigger than the first chunk, so it takes a new one
+  char * ptr4 = ( char * ) resource.allocate( 1000, 16 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 && ptr4 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr2 % 8, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr3 % 16, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr4 % 16, 0 );
+  TINYTEST_ASSERT( ptr2 >= ptr1 + 3 && ptr3 >= ptr2 + 8 );
+
+  memset( ptr4, 0xab, 1000 );
+  resource.deallocate( ptr4, 1000, 16 );
+
+  TINYTEST_ASSERT( resource.is_equal( resource ) );
+  TINYTEST_ASSERT( !resource.is_equal( other ) );
+
+  resource.release( );
+  mavalloc_free( odd );
+
+  // If you failed here a chunk was not returned to the arena
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  // It starts over after a release
+  TINYTEST_ASSERT( resource.allocate( 16, 16 ) );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 8: Test the pool pmr resource reuses blocks of a size class
+*
+*/
+int test_case_8( const char * )
+{
+  mavalloc::arena heap( 1 << 20 );
+  pool_arena_resource resource;
+  pool_arena_resource other;
+
+  void * ptr1 = resource.allocate( 24, 8 );
+  void * ptr2 = resource.allocate( 100, 16 );
+  void * ptr3 = resource.allocate( 10000, 16 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr1 % 8, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr2 % 16, 0 );
+  TINYTEST_EQUAL( ( std::uintptr_t ) ptr3 % 16, 0 );
+
+  // A freed block is the next one handed out in its class
+  resource.deallocate( ptr1, 24, 8 );
+  TINYTEST_EQUAL( resource.allocate( 20, 8 ), ptr1 );
+
+  TINYTEST_ASSERT( resource.is_equal( resource ) );
+  TINYTEST_ASSERT( !resource.is_equal( other ) );
+
+  resource.deallocate( ptr3, 10000, 16 );
+  resource.release( );
+
+  // If you failed here a slab or a large block was not returned
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  return 1;
+}
+
+int tinytest_setup(const char *pName)
+{
+    fprintf( stderr, "tinytest_setup(%s)\n", pName);
+    return 0;
+}
+
+int tinytest_teardown(const char *pName)
+{
+    fprintf( stderr, "tinytest_teardown(%s)\n", pName);
+    return 0;
+}
+
+TINYTEST_START_SUITE(ArenaTemplateTestSuite);
+  TINYTEST_ADD_TEST(test_case_1,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_2,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_3,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_4,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_5,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_6,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_7,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_8,tinytest_setup,tinytest_teardown);
+TINYTEST_END_SUITE();
+
+TINYTEST_MAIN_SINGLE_SUITE(ArenaTemplateTestSuite);
@@ -0,0 +1,115 @@
+// Benchmark std::pmr containers on the mavalloc resources against new/delete.
+//
+// Build with "make bench_pmr" and run ./bench_pmr [elements]. Each workload
+// fills a container, walks it and tears it down; times are wall clock
+// milliseconds for the whole cycle.
+
+#include "mavalloc_pmr.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const std::size_t ARENA_SIZE = 512 * 1024 * 1024;
+
+static long long checksum;
+
+static void vector_workload( std::pmr::memory_resource * resource, int n )
+{
+  std::pmr::vector<int> v( resource );
+  for( int i = 0; i < n; i++ )
+  {
+    v.push_back( i );
+  }
+  for( int x : v )
+  {
+    checksum += x;
+  }
+}
+
+static void map_workload( std::pmr::memory_resource * resource, int n )
+{
+  std::pmr::unordered_map<int, int> m( resource );
+  for( int i = 0; i < n; i++ )
+  {
+    m[ i ] = i * 2;
+  }
+  for( int i = 0; i < n; i += 3 )
+  {
+    m.erase( i );
+  }
+  checksum += m.size( );
+}
+
+static void string_workload( std::pmr::memory_resource * resource, int n )
+{
+  std::pmr::vector<std::pmr::string> v( resource );
+  for( int i = 0; i < n; i++ )
+  {
+    // Long enough to defeat the small string optimisation
+    v.emplace_back( "arena allocated string number " + std::to_string( i ) );
+  }
+  for( const auto & s : v )
+  {
+    checksum += s.size( );
+  }
+}
+
+typedef void ( *workload )( std::pmr::memory_resource *, int );
+
+static double time_ms( workload fn, std::pmr::memory_resource * resource, int n )
+{
+  auto begin = std::chrono::steady_clock::now( );
+  fn( resource, n );
+  auto end = std::chrono::steady_clock::now( );
+  return std::chrono::duration<double, std::milli>( end - begin ).count( );
+}
+
+int main( int argc, char * argv[] )
+{
+  int n = 20000;
+  if( argc > 1 )
+  {
+    n = atoi( argv[ 1 ] );
+  }
+
+  const char * names[]     = { "vector<int>", "unordered_map<int,int>", "vector<string>" };
+  workload     workloads[] = { vector_workload, map_workload, string_workload };
+
+  printf( "%-24s %12s %12s %12s %12s\n", "workload", "new/delete", "arena", "monotonic", "pool" );
+
+  for( int w = 0; w < 3; w++ )
+  {
+    double results[ 4 ];
+
+    results[ 0 ] = time_ms( workloads[ w ], std::pmr::new_delete_resource( ), n );
+
+    {
+      mavalloc::arena arena( ARENA_SIZE, FIRST_FIT );
+      mavalloc::arena_resource resource;
+      results[ 1 ] = time_ms( workloads[ w ], &resource, n );
+    }
+
+    {
+      mavalloc::arena arena( ARENA_SIZE, FIRST_FIT );
+      mavalloc::monotonic_arena_resource resource( 1 << 20 );
+      results[ 2 ] = time_ms( workloads[ w ], &resource, n );
+    }
+
+    {
+      mavalloc::arena arena( ARENA_SIZE, FIRST_FIT );
+      mavalloc::pool_arena_resource resource;
+      results[ 3 ] = time_ms( workloads[ w ], &resource, n );
+    }
+
+    printf( "%-24s %10.2fms %10.2fms %10.2fms %10.2fms\n", names[ w ],
+            results[ 0 ], results[ 1 ], results[ 2 ], results[ 3 ] );
+  }
+
+  printf( "checksum %lld\n", checksum );
+  return 0;
+}
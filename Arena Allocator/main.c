@@ -2,6 +2,9 @@
 #include "tinytest.h"
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 /*
 *
 * TEST CASE 1: Test init and a single allocation
@@ -638,6 +641,430 @@ int test_case_20()
   return 1;
 }
 
+/*
+*
+* TEST CASE 21: Test a file backed arena survives a reopen
+*
+*/
+int test_case_21()
+{
+  const char * path = "test_case_21.arena";
+  unlink( path );
+
+  // A new file gives a fresh arena
+  TINYTEST_EQUAL( mavalloc_init_file( path, 65536, FIRST_FIT ), 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc( 64 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+
+  memcpy( ptr2, "THIS IS THE TEST STRING", 24 );
+  mavalloc_set_root( ptr2 );
+  mavalloc_free( ptr1 );
+
+  size_t offset = mavalloc_offset( ptr2 );
+  int size = mavalloc_size();
+  mavalloc_destroy( );
+
+  // Reopening maps the same arena and list back in
+  TINYTEST_EQUAL( mavalloc_init_file( path, 0, FIRST_FIT ), 1 );
+  TINYTEST_EQUAL( mavalloc_size(), size );
+
+  char * root = ( char * ) mavalloc_root( );
+
+  // If you failed here the root was not kept in the file
+  TINYTEST_ASSERT( root );
+  TINYTEST_EQUAL( mavalloc_offset( root ), offset );
+  TINYTEST_EQUAL( memcmp( root, "THIS IS THE TEST STRING", 24 ), 0 );
+
+  // The hole ptr1 left is still free and gets reused
+  char * ptr3 = ( char * ) mavalloc_alloc( 1000 );
+  TINYTEST_EQUAL( mavalloc_offset( ptr3 ), 0 );
+
+  mavalloc_free( ptr3 );
+  mavalloc_free( root );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  mavalloc_destroy( );
+
+  // A file that is not an arena is refused and left as it was
+  char text[ 24 ] = { 0 };
+  FILE * file = fopen( path, "w" );
+  fputs( "THIS IS THE TEST STRING", file );
+  fclose( file );
+
+  TINYTEST_EQUAL( mavalloc_init_file( path, 65536, FIRST_FIT ), -1 );
+
+  file = fopen( path, "r" );
+  TINYTEST_EQUAL( fread( text, 1, sizeof( text ), file ), 23 );
+  fclose( file );
+  TINYTEST_EQUAL( strcmp( text, "THIS IS THE TEST STRING" ), 0 );
+
+  unlink( path );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 22: Test two processes sharing one arena
+*
+*/
+int test_case_22()
+{
+  const char * name = "/mavalloc_test_case_22";
+  int fds[ 2 ];
+  size_t offset = 0;
+  int status = 0;
+
+  mavalloc_unlink_shared( name );
+
+  // If you failed here the shared arena could not be created
+  TINYTEST_EQUAL( mavalloc_init_shared( name, 65536, FIRST_FIT ), 0 );
+  TINYTEST_EQUAL( pipe( fds ), 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  TINYTEST_ASSERT( ptr1 );
+
+  pid_t pid = fork( );
+  if( pid == 0 )
+  {
+    // Detach from the inherited mapping and attach by name, as an
+    // unrelated process would
+    mavalloc_destroy( );
+    if( mavalloc_init_shared( name, 0, FIRST_FIT ) != 1 )
+    {
+      _exit( 1 );
+    }
+
+    char * ptr2 = ( char * ) mavalloc_alloc( 64 );
+    if( ptr2 == NULL )
+    {
+      _exit( 2 );
+    }
+    memcpy( ptr2, "THIS IS THE TEST STRING", 24 );
+
+    offset = mavalloc_offset( ptr2 );
+    write( fds[ 1 ], &offset, sizeof( offset ) );
+    mavalloc_destroy( );
+    _exit( 0 );
+  }
+
+  TINYTEST_EQUAL( read( fds[ 0 ], &offset, sizeof( offset ) ), sizeof( offset ) );
+  waitpid( pid, &status, 0 );
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+
+  // If you failed here the child could not attach or allocate
+  TINYTEST_EQUAL( status, 0 );
+
+  // The child's block follows ptr1 and holds what it wrote
+  char * shared = ( char * ) mavalloc_pointer( offset );
+  TINYTEST_EQUAL( offset, 1000 );
+  TINYTEST_EQUAL( memcmp( shared, "THIS IS THE TEST STRING", 24 ), 0 );
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  mavalloc_free( shared );
+  mavalloc_free( ptr1 );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  mavalloc_destroy( );
+  mavalloc_unlink_shared( name );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 23: Test lifetime hints keep short and long lived blocks apart
+*
+*/
+static void * auto_site( size_t size )
+{
+  return mavalloc_alloc_hint( size, LIFETIME_AUTO );
+}
+
+int test_case_23()
+{
+  int i;
+
+  mavalloc_init( 65536, FIRST_FIT );
+
+  char * long1  = ( char * ) mavalloc_alloc_hint( 1000, LIFETIME_LONG );
+  char * short1 = ( char * ) mavalloc_alloc_hint( 1000, LIFETIME_SHORT );
+  char * long2  = ( char * ) mavalloc_alloc_hint( 1000, LIFETIME_LONG );
+
+  TINYTEST_ASSERT( long1 );
+  TINYTEST_ASSERT( short1 );
+  TINYTEST_ASSERT( long2 );
+
+  // Long lived blocks pack from the bottom, short lived from the top
+  TINYTEST_EQUAL( long2 - long1, 1000 );
+  TINYTEST_EQUAL( short1 - long1, 65536 - 1000 );
+  TINYTEST_EQUAL( mavalloc_size(), 4 );
+
+  mavalloc_free( short1 );
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  // A site whose blocks are freed straight away is learned as short lived
+  for( i = 0; i < 64; i++ )
+  {
+    mavalloc_free( auto_site( 100 ) );
+  }
+
+  char * learned = ( char * ) auto_site( 100 );
+
+  // If you failed here LIFETIME_AUTO did not move the site to the top
+  TINYTEST_EQUAL( learned - long1, 65536 - 100 );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 24: Test the heap profiler tracks live sampled bytes
+*
+*/
+static long profile_total( )
+{
+  char line[ 4096 ];
+  long total = 0;
+  FILE * file = tmpfile( );
+
+  mavalloc_profile_dump( fileno( file ) );
+  rewind( file );
+
+  while( fgets( line, sizeof( line ), file ) )
+  {
+    char * bytes = strrchr( line, ' ' );
+    if( bytes )
+    {
+      total += atol( bytes + 1 );
+    }
+  }
+  fclose( file );
+  return total;
+}
+
+int test_case_24()
+{
+  mavalloc_init( 65536, FIRST_FIT );
+
+  // Sampling every byte records every allocation at its exact size
+  TINYTEST_EQUAL( mavalloc_profile_start( 1 ), 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc( 2000 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_EQUAL( profile_total( ), 3000 );
+
+  mavalloc_free( ptr1 );
+
+  // If you failed here freeing did not take the sample off its stack
+  TINYTEST_EQUAL( profile_total( ), 2000 );
+
+  mavalloc_profile_stop( );
+  char * ptr3 = ( char * ) mavalloc_alloc( 1000 );
+  TINYTEST_ASSERT( ptr3 );
+  TINYTEST_EQUAL( profile_total( ), 2000 );
+
+  mavalloc_free( ptr2 );
+  mavalloc_free( ptr3 );
+  TINYTEST_EQUAL( profile_total( ), 0 );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 25: Test ADAPTIVE switches algorithm with the workload
+*
+*/
+int test_case_25()
+{
+  char * ptrs[ 1000 ];
+  int i;
+
+  mavalloc_init( 25000, ADAPTIVE );
+  TINYTEST_EQUAL( mavalloc_algorithm( ), FIRST_FIT );
+
+  // Filling the arena front to back makes every first fit search walk all
+  // the used nodes
+  for( i = 0; i < 1000; i++ )
+  {
+    ptrs[ i ] = ( char * ) mavalloc_alloc( 20 );
+    TINYTEST_ASSERT( ptrs[ i ] );
+  }
+
+  // If you failed here long searches did not move ADAPTIVE to next fit
+  TINYTEST_EQUAL( mavalloc_algorithm( ), NEXT_FIT );
+
+  // Punch small holes, then keep asking for more than the largest hole
+  for( i = 0; i < 1000; i += 2 )
+  {
+    mavalloc_free( ptrs[ i ] );
+  }
+  for( i = 0; i < 256; i++ )
+  {
+    TINYTEST_EQUAL( mavalloc_alloc( 6000 ), NULL );
+  }
+
+  // If you failed here failures in a fragmented arena did not pick best fit
+  TINYTEST_EQUAL( mavalloc_algorithm( ), BEST_FIT );
+
+  // The list is still intact after the switches
+  for( i = 1; i < 1000; i += 2 )
+  {
+    mavalloc_free( ptrs[ i ] );
+  }
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 26: Test a snapshot lists every block in address order
+*
+*/
+int test_case_26()
+{
+  struct mavalloc_snapshot_header header;
+  struct mavalloc_snapshot_record record;
+  unsigned long long expected_offset = 0;
+  unsigned long long used = 0;
+  unsigned long long i;
+
+  mavalloc_init( 65536, FIRST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc( 2000 );
+  char * ptr3 = ( char * ) mavalloc_alloc( 3000 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+  mavalloc_free( ptr2 );
+
+  FILE * file = tmpfile( );
+  TINYTEST_EQUAL( mavalloc_snapshot( fileno( file ) ), 0 );
+  rewind( file );
+
+  TINYTEST_EQUAL( fread( &header, sizeof( header ), 1, file ), 1 );
+  TINYTEST_EQUAL( strcmp( header.magic, MAVALLOC_SNAPSHOT_MAGIC ), 0 );
+  TINYTEST_EQUAL( header.arena_size, 65536 );
+
+  // If you failed here the snapshot did not list every node
+  TINYTEST_EQUAL( header.count, mavalloc_size() );
+
+  for( i = 0; i < header.count; i++ )
+  {
+    TINYTEST_EQUAL( fread( &record, sizeof( record ), 1, file ), 1 );
+    TINYTEST_EQUAL( record.offset, expected_offset );
+    expected_offset += record.size;
+    used += record.used ? record.size : 0;
+  }
+
+  TINYTEST_EQUAL( expected_offset, 65536 );
+  TINYTEST_EQUAL( used, 4000 );
+
+  fclose( file );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 27: Test Coalescing Free Blocks with a used block after them
+*
+* Freeing two adjacent blocks must merge them into one free block that
+* can be handed out whole, without touching the used block that follows.
+*
+*/
+int test_case_27()
+{
+  mavalloc_init( 4000, FIRST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr3 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr4 = ( char * ) mavalloc_alloc( 1000 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 && ptr4 );
+
+  mavalloc_free( ptr1 );
+  mavalloc_free( ptr2 );
+
+  // If you failed here the two free blocks were not combined
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  char * ptr5 = ( char * ) mavalloc_alloc( 2000 );
+
+  // If you failed here the combined block could not hold both sizes
+  TINYTEST_EQUAL( ptr5, ptr1 );
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  mavalloc_free( ptr3 );
+  mavalloc_free( ptr4 );
+  mavalloc_free( ptr5 );
+
+  // If you failed here a node after the merge was lost or freed twice
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 28: Test a file with a damaged spare node list is refused
+*
+*/
+static int reopen_with_spare( const char * path, int spare )
+{
+  // spare follows magic, version, four 64 bit fields, node_capacity,
+  // node_top and head in the file's header
+  int fd = open( path, O_RDWR );
+  int written = pwrite( fd, &spare, sizeof( spare ), 52 ) == sizeof( spare );
+  close( fd );
+
+  return written ? mavalloc_init_file( path, 0, FIRST_FIT ) : -2;
+}
+
+int test_case_28()
+{
+  const char * path = "test_case_28.arena";
+  unlink( path );
+
+  TINYTEST_EQUAL( mavalloc_init_file( path, 65536, FIRST_FIT ), 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc( 1000 );
+  char * ptr3 = ( char * ) mavalloc_alloc( 1000 );
+
+  TINYTEST_ASSERT( ptr1 && ptr2 && ptr3 );
+
+  // Merging puts node table entries on the spare list
+  mavalloc_free( ptr1 );
+  mavalloc_free( ptr2 );
+  mavalloc_destroy( );
+
+  TINYTEST_EQUAL( mavalloc_init_file( path, 0, FIRST_FIT ), 1 );
+  mavalloc_destroy( );
+
+  // A spare entry past the table
+  TINYTEST_EQUAL( reopen_with_spare( path, 100000 ), -1 );
+
+  // A spare entry that is also on the allocation list
+  TINYTEST_EQUAL( reopen_with_spare( path, 0 ), -1 );
+
+  unlink( path );
+  return 1;
+}
+
 int tinytest_setup(const char *pName)
 {
     fprintf( stderr, "tinytest_setup(%s)\n", pName);
@@ -674,6 +1101,14 @@ TINYTEST_START_SUITE(MavAllocTestSuite);
   TINYTEST_ADD_TEST(test_case_18,tinytest_setup,tinytest_teardown);
   TINYTEST_ADD_TEST(test_case_19,tinytest_setup,tinytest_teardown);
   TINYTEST_ADD_TEST(test_case_20,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_21,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_22,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_23,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_24,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_25,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_26,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_27,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_28,tinytest_setup,tinytest_teardown);
 TINYTEST_END_SUITE();
 
 TINYTEST_MAIN_SINGLE_SUITE(MavAllocTestSuite);
@@ -34,7 +34,46 @@
 #include "mavalloc.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Node links are table indices; NIL marks the end of a list
+#define NIL -1
+
+//Identifies a mavalloc arena file and its layout
+#define MAVALLOC_MAGIC    0x4c56414d
+#define MAVALLOC_VERSION  4
+
+//Nodes preallocated in the heap node table, which grows on demand
+#define HEAP_NODES        64
+
+//The node table in a file or shared memory object cannot grow, so size it
+//for one node per this many arena bytes
+#define FILE_BYTES_PER_NODE  256
+
+//Lifetime learning for LIFETIME_AUTO: one in (LIFETIME_SAMPLE_MASK + 1)
+//allocations is sampled, and a call site whose sampled blocks live fewer than
+//SHORT_LIFETIME allocations on average, over at least LIFETIME_MIN_SAMPLES
+//frees, is treated as short lived
+#define LIFETIME_SITES        256
+#define LIFETIME_PROBES       8
+#define LIFETIME_SAMPLE_MASK  7
+#define LIFETIME_MIN_SAMPLES  4
+#define SHORT_LIFETIME        1024
+
+//Heap profiler: distinct sampled stacks kept, and frames kept per stack
+#define PROFILE_STACKS        1024
+#define PROFILE_DEPTH         32
+
+#define PAGE_ALIGN(s)  ( ( ( s ) + 4095 ) & ~( size_t ) 4095 )
 
 //to define predefined constants if node is being used or if it is free
 enum TYPE
@@ -43,25 +82,354 @@ enum TYPE
   USED
 };
 
-//Linked list structure for node properties 
+//Linked list structure for node properties. Links are indices into the node
+//table and the block is an offset into the arena, so the list stays valid
+//wherever the arena is mapped.
 struct Node {
-  size_t size;
-  enum TYPE type;
-  void * arena;
-  struct Node * next;
-  struct Node * prev;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t birth;          // allocation clock when a sampled block was made
+  int32_t  type;
+  int32_t  next;
+  int32_t  prev;
+  int32_t  site;           // lifetime site slot + 1 of a sampled block, else 0
+  uint64_t weight;         // bytes a profiler sample stands for
+  int32_t  stack;          // profiler stack slot + 1 of a sampled block, else 0
+  int32_t  pid;            // process that took the profiler sample
+};
+
+//Allocator state. In file and shared mode it is stored at the start of the
+//mapping, ahead of the node table and the arena.
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t arena_size;
+  uint64_t arena_offset;   // from the start of the file
+  uint64_t root;           // offset of the user's root block + 1, 0 if unset
+  uint64_t clock;          // allocations made so far
+  int32_t  node_capacity;
+  int32_t  node_top;       // table entries handed out so far
+  int32_t  head;           // first node of the allocation list
+  int32_t  spare;          // list of released table entries
+  int32_t  previous;       // last accessed node, for next fit
+  int32_t  algorithm;
+  int32_t  shared;         // lock is in use
+  pthread_mutex_t lock;    // process shared, robust
+};
+
+//Header used when the arena is on the heap
+static struct Header heap_header;
+
+//Current allocator state, node table and arena. header is NULL when there
+//is no arena.
+static struct Header * header;
+static struct Node * nodes;
+static char * arena;
+
+//Per call site lifetime statistics for LIFETIME_AUTO. Call site addresses
+//only mean something in this process, so the table is not part of the
+//mapping.
+struct Site {
+  void *   address;
+  uint64_t samples;
+  uint64_t total_lifetime;
+};
+
+static struct Site sites[ LIFETIME_SITES ];
+
+//Heap profiler state. A block is sampled when the bytes allocated since the
+//last sample pass a randomly drawn threshold; between samples the cost is a
+//subtraction and a compare. Like the site table, stacks are per process.
+struct Stack {
+  uint64_t hash;
+  int      depth;
+  void *   frames[ PROFILE_DEPTH ];
+  uint64_t live_bytes;     // estimated bytes still allocated from this stack
+  uint64_t live_blocks;    // sampled blocks still allocated
 };
 
-//globals for allocation list and last accessed node
-struct Node *alloc_list;
-struct Node *previous_node;
+static struct Stack stacks[ PROFILE_STACKS ];
+static double  profile_rate;                        // mean bytes between samples, 0 if off
+static int64_t bytes_until_sample = INT64_MAX;
+static unsigned int profile_seed = 1;
 
+//File or shared memory mapping, when the arena is not on the heap
+static void * mapping;
+static size_t mapping_size;
+static int mapping_fd = -1;
+
+//The arena lock when other processes share the arena, otherwise NULL
+static pthread_mutex_t * shared_lock;
+
+//Nodes visited by the placement functions, for ADAPTIVE
+static uint64_t search_steps;
+
+// Placement functions, one per algorithm. Each returns the index of the free
+// node the request should go in, or NIL if none fits. mavalloc_init picks one
+// of them so mavalloc_alloc does not have to test the algorithm on every call.
+
+// No arena: every request fails
+static int place_none( size_t aligned_size )
+{
+  ( void ) aligned_size;
+  return NIL;
+}
+
+// First fit: the first free node, from the head of the list, that is big enough
+static int place_first_fit( size_t aligned_size )
+{
+  int node = header -> head;
+
+  while( node != NIL )
+  {
+    if( nodes[ node ].size >= aligned_size && nodes[ node ].type == FREE )
+    {
+      return node;
+    }
+    node = nodes[ node ].next;
+    search_steps++;
+  }
+  return NIL;
+}
+
+// Next fit: same as first fit, but start from the previously assigned node
+// and wrap around to the head of the list
+static int place_next_fit( size_t aligned_size )
+{
+  int node = header -> previous;
+
+  while ( node != NIL )
+  {
+    if ( nodes[ node ].size >= aligned_size && nodes[ node ].type == FREE )
+    {
+      return node;
+    }
+    node = nodes[ node ].next;
+    search_steps++;
+
+    if ( node == NIL )
+      node = header -> head;
+
+    if ( node == header -> previous ) 
+      break;
+  }
+  return NIL;
+}
+
+// Best fit: the free node that leaves the smallest leftover
+static int place_best_fit( size_t aligned_size )
+{
+  int node      = header -> head;
+  int best_node = NIL;
+
+  while ( node != NIL )
+  {
+    if ( nodes[ node ].size >= aligned_size && nodes[ node ].type == FREE && 
+         ( best_node == NIL || nodes[ node ].size < nodes[ best_node ].size ) )
+    {
+      best_node = node;
+    }
+    node = nodes[ node ].next;
+    search_steps++;
+  }
+  return best_node;
+}
+
+// Worst fit: the largest free node
+static int place_worst_fit( size_t aligned_size )
+{
+  int node     = header -> head;
+  int max_node = NIL;
+
+  while ( node != NIL )
+  {
+    if ( nodes[ node ].type == FREE && 
+         ( max_node == NIL || nodes[ node ].size > nodes[ max_node ].size ) )
+    {
+      max_node = node;
+    }
+    node = nodes[ node ].next;
+    search_steps++;
+  }
+
+  if ( max_node == NIL || nodes[ max_node ].size < aligned_size )
+  {
+    return NIL;
+  }
+  return max_node;
+}
+
+//Placement function for the active algorithm, set by set_algorithm
+static int ( * place )( size_t ) = place_none;
+
+// Indexed by enum ALGORITHM
+static int ( * const placement_table[ ] )( size_t ) =
+{
+  place_first_fit,
+  place_next_fit,
+  place_best_fit,
+  place_worst_fit,
+  place_first_fit     // ADAPTIVE starts out as first fit
+};
 
-//Arena pointer to track memory
-void * arena;
+//ADAPTIVE state. Every ADAPTIVE_WINDOW allocations the window's search
+//length, failure rate and the arena's fragmentation pick the algorithm for
+//the next window. Only the next fit cursor is specific to an algorithm and
+//it is kept up to date whichever one is active, so switching is always safe.
+#define ADAPTIVE_WINDOW          256
+#define ADAPTIVE_LONG_SEARCH     32     // mean nodes visited per allocation
+#define ADAPTIVE_FAILURE_RATE    0.01
+#define ADAPTIVE_FRAGMENTED      0.5    // 1 - largest free / total free
 
-//global variable, allocation_algorithm, for determining the algorithm in use
-enum ALGORITHM allocation_algorithm = FIRST_FIT;
+static int adaptive;
+static enum ALGORITHM active_algorithm;
+static int window_allocations;
+static int window_failures;
+static uint64_t window_start_steps;
+
+//Make algorithm the one mavalloc_alloc uses
+static void set_algorithm( enum ALGORITHM algorithm )
+{
+  adaptive = ( algorithm == ADAPTIVE );
+  active_algorithm = adaptive ? FIRST_FIT : algorithm;
+  place = placement_table[ algorithm ];
+
+  window_allocations = 0;
+  window_failures    = 0;
+  window_start_steps = search_steps;
+}
+
+//Fraction of free space that is not in the largest free node
+static double fragmentation( )
+{
+  uint64_t total = 0;
+  uint64_t largest = 0;
+  int node;
+
+  for( node = header -> head; node != NIL; node = nodes[ node ].next )
+  {
+    if( nodes[ node ].type == FREE )
+    {
+      total += nodes[ node ].size;
+      if( nodes[ node ].size > largest )
+      {
+        largest = nodes[ node ].size;
+      }
+    }
+  }
+  return total == 0 ? 0.0 : 1.0 - ( double ) largest / total;
+}
+
+//Count an allocation and, at the end of a window, choose the algorithm for
+//the next one:
+//  failures in a fragmented arena  -> best fit, to keep large holes whole
+//  long searches                   -> next fit, to stop rescanning the front
+//  otherwise                       -> first fit
+static void adapt( int failed )
+{
+  window_allocations++;
+  window_failures += failed;
+
+  if( window_allocations < ADAPTIVE_WINDOW )
+  {
+    return;
+  }
+
+  double mean_search  = ( double ) ( search_steps - window_start_steps ) / window_allocations;
+  double failure_rate = ( double ) window_failures / window_allocations;
+  double fragmented   = fragmentation( );
+  enum ALGORITHM next = FIRST_FIT;
+
+  if( failure_rate > ADAPTIVE_FAILURE_RATE && fragmented > ADAPTIVE_FRAGMENTED )
+  {
+    next = BEST_FIT;
+  }
+  else if( mean_search > ADAPTIVE_LONG_SEARCH )
+  {
+    next = NEXT_FIT;
+  }
+
+  active_algorithm = next;
+  place = placement_table[ next ];
+
+  window_allocations = 0;
+  window_failures    = 0;
+  window_start_steps = search_steps;
+}
+
+//Take an entry from the node table. Returns NIL if the table is full and
+//cannot grow.
+static int node_new( )
+{
+  int index;
+
+  if( header -> spare != NIL )
+  {
+    index = header -> spare;
+    header -> spare = nodes[ index ].next;
+    return index;
+  }
+
+  if( header -> node_top == header -> node_capacity )
+  {
+    // A mapped table is fixed by the layout of the mapping
+    if( mapping != NULL )
+    {
+      return NIL;
+    }
+
+    int capacity = header -> node_capacity * 2;
+    struct Node * grown = ( struct Node * ) realloc( nodes, capacity * sizeof( struct Node ) );
+
+    if( grown == NULL )
+    {
+      return NIL;
+    }
+    nodes = grown;
+    header -> node_capacity = capacity;
+  }
+
+  return header -> node_top++;
+}
+
+//Give a node table entry back
+static void node_release( int index )
+{
+  nodes[ index ].next = header -> spare;
+  header -> spare = index;
+}
+
+//Start a fresh allocation list with a single free node covering the arena.
+//The magic number is left for publish_header to set.
+static void reset_header( size_t arena_size, size_t arena_offset, int capacity,
+                          enum ALGORITHM algorithm )
+{
+  memset( header, 0, sizeof( struct Header ) );
+  header -> version       = MAVALLOC_VERSION;
+  header -> arena_size    = arena_size;
+  header -> arena_offset  = arena_offset;
+  header -> node_capacity = capacity;
+  header -> node_top      = 1;
+  header -> head          = 0;
+  header -> spare         = NIL;
+  header -> previous      = 0;
+  header -> algorithm     = algorithm;
+
+  nodes[ 0 ].offset = 0;
+  nodes[ 0 ].size   = arena_size;
+  nodes[ 0 ].type   = FREE;
+  nodes[ 0 ].next   = NIL;
+  nodes[ 0 ].prev   = NIL;
+  nodes[ 0 ].site   = 0;
+  nodes[ 0 ].stack  = 0;
+}
+
+//Mark the header complete. Processes attaching to a shared arena wait for
+//the magic number before touching anything else.
+static void publish_header( )
+{
+  __atomic_store_n( &header -> magic, MAVALLOC_MAGIC, __ATOMIC_RELEASE );
+}
 
 //Mavalloc_init function to use malloc to allocate a pool of memory that is size bytes long.
 
@@ -73,263 +441,1004 @@ int mavalloc_init( size_t size, enum ALGORITHM algorithm )
     return -1;
   }
 
+  //Unknown algorithms are rejected here rather than on every allocation
+  if( algorithm < FIRST_FIT || algorithm > ADAPTIVE )
+  {
+    return -1;
+  }
+
   //Memory allocation using ALIGN4 macro, provided by professor in mavalloc.h
   //This will ensure size is 4 byte long.
-  arena = malloc( ALIGN4( size ) );
+  arena = ( char * ) malloc( ALIGN4( size ) );
 
   // If allocation fails return -1
   if( arena == NULL )
   {
     return -1;
   }
-    
-  allocation_algorithm = algorithm;
 
-  alloc_list = ( struct Node * )malloc( sizeof( struct Node ));
+  nodes = ( struct Node * ) malloc( HEAP_NODES * sizeof( struct Node ) );
+
+  if( nodes == NULL )
+  {
+    free( arena );
+    arena = NULL;
+    return -1;
+  }
 
-  alloc_list -> arena = arena;
-  alloc_list -> size  = ALIGN4(size);
-  alloc_list -> type  = FREE;
-  alloc_list -> next  = NULL;
-  alloc_list -> prev  = NULL;
+  header = &heap_header;
+  reset_header( ALIGN4( size ), 0, HEAP_NODES, algorithm );
+  publish_header( );
 
-  previous_node  = alloc_list;
+  set_algorithm( algorithm );
 
   return 0;
 }
 
-//Function to assign leftover space in memory allocation algorithms
-void assign_leftover( struct Node * node, size_t size, size_t aligned_size ){
-  int leftover_size = 0; // leftover_size to determine the size of a node that is leftover,
-                         // after a process is allocated to a node which is less than node size.
-  
-  node -> type  = USED; // FREE node is marked as USED after a process is allocated to it.
-  leftover_size = node -> size - aligned_size;
-  node -> size =  aligned_size;
+//Walk a recovered allocation list and make sure it tiles the arena exactly,
+//and that the spare entries are in the table and on no list twice, so
+//node_new can trust them
+static int list_is_valid( )
+{
+  uint64_t expected = 0;
+  int prev  = NIL;
+  int node  = header -> head;
+  int valid = 1;
 
-  //If there is any leftover space after a process is allocated to the node, the arena
-  //pointer will be pointing to start of leftover space and a new node with leftover space
-  //will be created.
-  if( leftover_size > 0 )
+  if( header -> node_top < 0 || header -> node_top > header -> node_capacity )
   {
-    struct Node * previous_next = node -> next;
-    struct Node * leftover_node = ( struct Node * ) malloc ( sizeof( struct Node ));    
+    return 0;
+  }
 
-    leftover_node -> arena = node -> arena + size;
-    leftover_node -> type  = FREE;
-    leftover_node -> size  = leftover_size;
-    leftover_node -> next  = previous_next;
+  char * seen = ( char * ) calloc( header -> node_top + 1, 1 );
 
-    node -> next = leftover_node;
+  if( seen == NULL )
+  {
+    return 0;
   }
-  previous_node = node;
-}
 
-// Function to find node with maximum size to implement in worst fit
-void find_maxNode( struct Node * maxNode, struct Node * node )
-{
-  // This will iterate through all available/free nodes and check for any node
-  // that is greater than maximum node and assign that value to 'maxNode' variable.
-  while ( node -> next != NULL )
+  while( node != NIL )
+  {
+    if( node < 0 || node >= header -> node_top || seen[ node ] ||
+        nodes[ node ].prev != prev || nodes[ node ].offset != expected ||
+        nodes[ node ].size == 0 || nodes[ node ].size > header -> arena_size - expected )
+    {
+      valid = 0;
+      break;
+    }
+    seen[ node ] = 1;
+    expected += nodes[ node ].size;
+    prev = node;
+    node = nodes[ node ].next;
+  }
+
+  valid = valid && expected == header -> arena_size;
+  node  = valid ? header -> spare : NIL;
+
+  while( node != NIL )
   {
-    node = node -> next;
-    if ( node -> size > maxNode -> size && node -> type == FREE )
+    if( node < 0 || node >= header -> node_top || seen[ node ] )
     {
-      maxNode = node;
+      valid = 0;
+      break;
     }
+    seen[ node ] = 1;
+    node = nodes[ node ].next;
   }
+
+  free( seen );
+  return valid;
 }
 
+//Layout of a new mapped arena: header, node table, then the page aligned
+//arena. Returns the size of the whole mapping.
+static size_t layout_region( size_t arena_size, int * capacity, size_t * arena_offset )
+{
+  *capacity     = arena_size / FILE_BYTES_PER_NODE + 16;
+  *arena_offset = PAGE_ALIGN( sizeof( struct Header ) + *capacity * sizeof( struct Node ) );
+  return *arena_offset + arena_size;
+}
 
-//mavalloc_destroy() function to free the allocated arena and empty the linked list
-void mavalloc_destroy( )
+//Map size bytes of fd and point the allocator state at the mapping
+static int map_region( int fd, size_t size )
 {
-  //To free the allocated arena
-  free( arena );
-  
-  // Iterate over the linked list and free the nodes
-  struct Node *list;
+  mapping = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
 
-  while( alloc_list != NULL ) 
+  if( mapping == MAP_FAILED )
   {
-    list = alloc_list;
-    alloc_list = alloc_list -> next;
-    free( list );
-  } 
+    mapping = NULL;
+    return -1;
+  }
 
-  return;
+  mapping_fd   = fd;
+  mapping_size = size;
+  header = ( struct Header * ) mapping;
+  nodes  = ( struct Node * ) ( header + 1 );
+  return 0;
 }
 
-// mavalloc_alloc function will allocate size bytes from preallocated memory arena using the
-// heap allocation algorithm that was specified during mavalloc_init. 
-// This function returns a pointer to the memory on success and NULL on failure. 
-void * mavalloc_alloc( size_t size )
+//Undo map_region
+static void unmap_region( )
 {
-  struct Node * node;
+  munmap( mapping, mapping_size );
+  close( mapping_fd );
+  mapping     = NULL;
+  mapping_fd  = -1;
+  header      = NULL;
+  nodes       = NULL;
+  arena       = NULL;
+  shared_lock = NULL;
+}
+
+//Map a file as the arena, creating it if needed or reopening it if it
+//already holds an arena
+int mavalloc_init_file( const char * path, size_t size, enum ALGORITHM algorithm )
+{
+  struct Header existing;
+  struct stat st;
+  size_t arena_size   = ALIGN4( size );
+  size_t arena_offset = 0;
+  size_t region_size  = 0;
+  int    capacity     = 0;
+  int    recovered    = 0;
 
-  // If allocation algorithm is not Next fit, then check entire list of nodes
-  // else start from previous node where process is allocated before. 
-  if( allocation_algorithm != NEXT_FIT )
-  { 
-    node = alloc_list;
+  if( algorithm < FIRST_FIT || algorithm > ADAPTIVE )
+  {
+    return -1;
   }
 
-  else if ( allocation_algorithm == NEXT_FIT )
+  int fd = open( path, O_RDWR | O_CREAT, 0644 );
+
+  if( fd < 0 || fstat( fd, &st ) != 0 )
   {
-    node = previous_node;
+    if( fd >= 0 ) close( fd );
+    return -1;
   }
 
-  // Print error if algorithm is other than first fit, next fit, worst fit and best fit
+  // An existing arena file keeps its own size and layout. Anything else
+  // in the file, including an arena of another version, is left alone.
+  if( st.st_size != 0 )
+  {
+    if( st.st_size < ( off_t ) sizeof( existing ) ||
+        pread( fd, &existing, sizeof( existing ), 0 ) != sizeof( existing ) ||
+        existing.magic != MAVALLOC_MAGIC || existing.version != MAVALLOC_VERSION ||
+        existing.node_capacity < 0 ||
+        existing.arena_offset < sizeof( existing ) + ( uint64_t ) existing.node_capacity * sizeof( struct Node ) ||
+        existing.arena_size > ( uint64_t ) st.st_size ||
+        existing.arena_offset > ( uint64_t ) st.st_size - existing.arena_size )
+    {
+      close( fd );
+      return -1;
+    }
+    region_size = existing.arena_offset + existing.arena_size;
+    recovered = 1;
+  }
   else
   {
-    printf("ERROR: Unknown allocation algorithm!\n");
-    exit(0);
+    region_size = layout_region( arena_size, &capacity, &arena_offset );
+
+    if( ftruncate( fd, region_size ) != 0 )
+    {
+      close( fd );
+      return -1;
+    }
   }
 
-  size_t aligned_size = ALIGN4( size );
+  if( map_region( fd, region_size ) != 0 )
+  {
+    close( fd );
+    return -1;
+  }
 
-  // If allocation algorithm is first fit.
-  if( allocation_algorithm == FIRST_FIT )
+  if( !recovered )
+  {
+    reset_header( arena_size, arena_offset, capacity, algorithm );
+    publish_header( );
+  }
+  else if( !list_is_valid( ) )
+  {
+    // Most likely the previous owner died mid update
+    unmap_region( );
+    return -1;
+  }
+  else
   {
-    // Assign process to first available free node, whose size is greater than the process size
-    while( node )
+    header -> previous  = header -> head;
+    header -> algorithm = algorithm;
+
+    // Samples from the previous process refer to its site and stack tables
+    for( int node = header -> head; node != NIL; node = nodes[ node ].next )
     {
+      nodes[ node ].site  = 0;
+      nodes[ node ].stack = 0;
+    }
+  }
+
+  // A lock left in the file by a shared arena means nothing here
+  header -> shared = 0;
+  arena = ( char * ) mapping + header -> arena_offset;
+  set_algorithm( algorithm );
+
+  return recovered;
+}
+
+//Create or attach to an arena in a POSIX shared memory object
+int mavalloc_init_shared( const char * name, size_t size, enum ALGORITHM algorithm )
+{
+  struct stat st;
+  size_t arena_size   = ALIGN4( size );
+  size_t arena_offset = 0;
+  size_t region_size  = 0;
+  int    capacity     = 0;
+  int    attached     = 0;
+  int    tries;
+
+  if( algorithm < FIRST_FIT || algorithm > ADAPTIVE )
+  {
+    return -1;
+  }
+
+  int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+
+  if( fd >= 0 )
+  {
+    region_size = layout_region( arena_size, &capacity, &arena_offset );
 
-      if( node -> size >= aligned_size  && node -> type == FREE )
+    if( ftruncate( fd, region_size ) != 0 || map_region( fd, region_size ) != 0 )
+    {
+      close( fd );
+      shm_unlink( name );
+      return -1;
+    }
+
+    reset_header( arena_size, arena_offset, capacity, algorithm );
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    pthread_mutex_init( &header -> lock, &attr );
+    pthread_mutexattr_destroy( &attr );
+    header -> shared = 1;
+
+    publish_header( );
+  }
+  else
+  {
+    if( errno != EEXIST || ( fd = shm_open( name, O_RDWR, 0600 ) ) < 0 )
+    {
+      return -1;
+    }
+
+    // The creator sizes the object and then publishes the header; give it
+    // up to a second to do both
+    for( tries = 0; tries < 1000; tries++ )
+    {
+      if( fstat( fd, &st ) != 0 )
       {
-        assign_leftover(node, size, aligned_size);
-        previous_node = node;
-        return ( void * ) node -> arena;
+        break;
+      }
+      if( st.st_size >= ( off_t ) sizeof( struct Header ) )
+      {
+        if( mapping == NULL && map_region( fd, st.st_size ) != 0 )
+        {
+          break;
+        }
+        if( __atomic_load_n( &header -> magic, __ATOMIC_ACQUIRE ) == MAVALLOC_MAGIC )
+        {
+          attached = 1;
+          break;
+        }
       }
-      node = node -> next;
+      usleep( 1000 );
     }
-  }
 
-  // If allocation algorithm is next fit  
-  else if (allocation_algorithm == NEXT_FIT)
-  {
-    // Same as first fit algorithm, but we check nodes starting from previously assigned node
-    // and return arena
-    while ( node )
+    if( !attached || header -> version != MAVALLOC_VERSION || !header -> shared )
     {
-      if ( node -> size >= aligned_size && node -> type == FREE )
+      if( mapping != NULL )
+      {
+        unmap_region( );
+      }
+      else
       {
-        assign_leftover( node, size, aligned_size );
-        previous_node = node;
-        return node -> arena;
+        close( fd );
       }
-      node = node -> next;
+      return -1;
+    }
+  }
 
-      if ( node == previous_node ) 
-        break;
+  shared_lock = &header -> lock;
+  arena = ( char * ) mapping + header -> arena_offset;
+  set_algorithm( algorithm );
+
+  return attached;
+}
+
+//Remove a shared memory arena's name
+int mavalloc_unlink_shared( const char * name )
+{
+  return shm_unlink( name ) == 0 ? 0 : -1;
+}
+
+//Take the arena lock if other processes share the arena. If the last owner
+//died holding it, carry on only if the allocation list is still intact;
+//otherwise the lock is left unrecoverable and this and every later call
+//fails. Returns 0 when the caller may proceed.
+static int lock_arena( )
+{
+  if( shared_lock == NULL )
+  {
+    return 0;
+  }
 
-      if ( node == NULL )
-        node = alloc_list;
+  int rc = pthread_mutex_lock( shared_lock );
+
+  if( rc == EOWNERDEAD )
+  {
+    if( list_is_valid( ) )
+    {
+      pthread_mutex_consistent( shared_lock );
+      return 0;
     }
+    pthread_mutex_unlock( shared_lock );
+    return -1;
+  }
+
+  return rc == 0 ? 0 : -1;
+}
 
+static void unlock_arena( )
+{
+  if( shared_lock != NULL )
+  {
+    pthread_mutex_unlock( shared_lock );
   }
+}
+
+//Function to assign leftover space in memory allocation algorithms
+static void assign_leftover( int node, size_t aligned_size )
+{
+  nodes[ node ].type = USED; // FREE node is marked as USED after a process is allocated to it.
 
-  // If allocation algorithm is Worst Fit
-  if ( allocation_algorithm == WORST_FIT )
+  //If there is any leftover space after a process is allocated to the node, a new
+  //node starting right after the allocated block takes the leftover space. If the
+  //node table is full the whole block is handed out instead.
+  if( nodes[ node ].size > aligned_size )
   {
-    // In this algorithm, we check for maximum available node among the list 
-    // and assign process to it.
-    struct Node *maxNode;
+    int leftover_node = node_new( );
 
-    while(node)
+    if( leftover_node != NIL )
     {
-      if ( node -> size >= aligned_size && node -> type == FREE )
-      {
-        maxNode = node;
-        find_maxNode( maxNode, node );
-        node = maxNode;
+      int previous_next = nodes[ node ].next;
 
-        assign_leftover( node, size, aligned_size );
-        previous_node = node;
-        return node -> arena;
+      nodes[ leftover_node ].offset = nodes[ node ].offset + aligned_size;
+      nodes[ leftover_node ].type   = FREE;
+      nodes[ leftover_node ].size   = nodes[ node ].size - aligned_size;
+      nodes[ leftover_node ].next   = previous_next;
+      nodes[ leftover_node ].prev   = node;
+      nodes[ leftover_node ].site   = 0;
+      nodes[ leftover_node ].stack  = 0;
+
+      if( previous_next != NIL )
+      {
+        nodes[ previous_next ].prev = leftover_node;
       }
-      node = node -> next;
+
+      nodes[ node ].next = leftover_node;
+      nodes[ node ].size = aligned_size;
     }
   }
+  header -> previous = node;
+}
+
+//Merge node with the free node that follows it
+static void absorb_next( int node )
+{
+  int absorbed = nodes[ node ].next;
 
-  // If allocation algorithm is Best Fit
-  if ( allocation_algorithm == BEST_FIT )
+  nodes[ node ].size += nodes[ absorbed ].size;
+  nodes[ node ].next  = nodes[ absorbed ].next;
+
+  if ( nodes[ node ].next != NIL )
   {
-    // we check for the node that the process can be best fit in
-    struct Node *best_node = NULL;
-    int best_size = INT_MAX;
+    nodes[ nodes[ node ].next ].prev = node;
+  }
 
-    // To find best node 
-    while ( node )
+  // Next fit must not resume from a node that no longer exists
+  if ( header -> previous == absorbed )
+  {
+    header -> previous = node;
+  }
+
+  node_release( absorbed );
+}
+
+//mavalloc_destroy() function to release the arena and empty the linked list.
+//A file backed arena is flushed and unmapped; the file is kept. A shared
+//arena is only detached from this process.
+void mavalloc_destroy( )
+{
+  if( header == NULL )
+  {
+    return;
+  }
+
+  if( mapping != NULL )
+  {
+    if( shared_lock == NULL )
+    {
+      msync( mapping, mapping_size, MS_SYNC );
+    }
+    unmap_region( );
+  }
+  else
+  {
+    //To free the allocated arena and the node table
+    free( arena );
+    free( nodes );
+  }
+
+  header = NULL;
+  nodes  = NULL;
+  arena  = NULL;
+  place  = place_none;
+  adaptive = 0;
+
+  return;
+}
+
+//Like assign_leftover, but the block is cut from the top of the free node so
+//the space left over stays below it. Returns the node holding the block.
+static int assign_high( int node, size_t aligned_size )
+{
+  if( nodes[ node ].size > aligned_size )
+  {
+    int used_node = node_new( );
+
+    if( used_node != NIL )
     {
-      if (node -> size >= aligned_size && node -> type == FREE && 
-          best_size > (node -> size - size)) 
+      int previous_next = nodes[ node ].next;
+
+      nodes[ node ].size -= aligned_size;
+
+      nodes[ used_node ].offset = nodes[ node ].offset + nodes[ node ].size;
+      nodes[ used_node ].size   = aligned_size;
+      nodes[ used_node ].type   = USED;
+      nodes[ used_node ].next   = previous_next;
+      nodes[ used_node ].prev   = node;
+      nodes[ used_node ].site   = 0;
+      nodes[ used_node ].stack  = 0;
+
+      if( previous_next != NIL )
       {
-        best_size = node -> size - size;
-        best_node = node;
+        nodes[ previous_next ].prev = used_node;
       }
-      node = node -> next;
+      nodes[ node ].next = used_node;
+      return used_node;
     }
+  }
+
+  nodes[ node ].type = USED;
+  return node;
+}
+
+//Short lived blocks: the highest free node that fits, searching back from
+//the end of the arena
+static int place_high( size_t aligned_size )
+{
+  int node = header -> head;
+  int high = NIL;
 
-    if ( best_node != NULL )
+  while( node != NIL )
+  {
+    if( nodes[ node ].size >= aligned_size && nodes[ node ].type == FREE )
     {
-      assign_leftover( best_node, size, aligned_size );
-      previous_node = best_node;
-      return best_node -> arena;
+      high = node;
     }
+    node = nodes[ node ].next;
   }
+  return high;
+}
+
+//Slot in the site table for a call site, or -1 if its probe run is full
+static int site_slot( void * address )
+{
+  int slot = ( int ) ( ( ( uintptr_t ) address >> 2 ) % LIFETIME_SITES );
+  int probe;
 
-  return NULL;
+  for( probe = 0; probe < LIFETIME_PROBES; probe++ )
+  {
+    struct Site * site = &sites[ ( slot + probe ) % LIFETIME_SITES ];
+
+    if( site -> address == address || site -> address == NULL )
+    {
+      site -> address = address;
+      return ( slot + probe ) % LIFETIME_SITES;
+    }
+  }
+  return -1;
 }
 
-// This function will free the block pointed by the pointer back to preallocated memory arena.
-// This function returns no value.  
-void mavalloc_free( void * ptr )
+//What the sampled statistics say about a call site
+static enum LIFETIME learned_lifetime( int slot )
+{
+  if( slot < 0 || sites[ slot ].samples < LIFETIME_MIN_SAMPLES )
+  {
+    return LIFETIME_UNKNOWN;
+  }
+  return ( sites[ slot ].total_lifetime / sites[ slot ].samples < SHORT_LIFETIME ) ?
+         LIFETIME_SHORT : LIFETIME_LONG;
+}
+
+//Bytes until the next profiler sample. Drawing the gap from an exponential
+//distribution makes every byte equally likely to be sampled.
+static int64_t next_sample_gap( )
 {
-  
-  struct Node *node = alloc_list;
+  double u = ( rand_r( &profile_seed ) + 1.0 ) / ( RAND_MAX + 2.0 );
+  return ( int64_t ) ( -log( u ) * profile_rate ) + 1;
+}
+
+//Record the stack of a sampled allocation of size bytes made from caller.
+//Returns the stack slot + 1, or 0 if the stack table is full.
+static int profile_sample( size_t size, void * caller, uint64_t * weight )
+{
+  void * frames[ PROFILE_DEPTH + 8 ];
+  int depth = backtrace( frames, PROFILE_DEPTH + 8 );
+  int first = 0;
+  int i;
+
+  bytes_until_sample = next_sample_gap( );
 
-  // check and update the node to free if pointer is found
-  while ( node )
+  // Drop the allocator's own frames: start at the caller's return address
+  for( i = 0; i < depth; i++ )
   {
-    if ( node -> arena == ptr ) {
-      node -> type = FREE;
+    if( frames[ i ] == caller )
+    {
+      first = i;
+      break;
     }
+  }
+  depth -= first;
+  if( depth > PROFILE_DEPTH )
+  {
+    depth = PROFILE_DEPTH;
+  }
 
-    node = node -> next;
+  uint64_t hash = 1469598103934665603ULL;
+  for( i = 0; i < depth; i++ )
+  {
+    hash = ( hash ^ ( uintptr_t ) frames[ first + i ] ) * 1099511628211ULL;
   }
 
-  node = alloc_list;
-  
-  // check all the nodes and combine the consecutive free nodes
-  while ( node )
+  int slot = ( int ) ( hash % PROFILE_STACKS );
+  int probe;
+
+  for( probe = 0; probe < PROFILE_STACKS; probe++ )
   {
-    if ( node -> type == FREE && node -> next && node -> next -> type == FREE )
+    struct Stack * stack = &stacks[ ( slot + probe ) % PROFILE_STACKS ];
+
+    if( stack -> depth == 0 )
+    {
+      stack -> hash  = hash;
+      stack -> depth = depth;
+      memcpy( stack -> frames, frames + first, depth * sizeof( void * ) );
+    }
+    else if( stack -> hash != hash )
     {
-      node -> size += node -> next -> size;
-      node -> next = node -> next -> next;
-      free( node -> next );
       continue;
     }
 
-    node = node -> next;
+    // A sample of size bytes stands for size / P(sampled) bytes
+    *weight = ( uint64_t ) ( size / ( 1.0 - exp( -( double ) size / profile_rate ) ) );
+    stack -> live_bytes  += *weight;
+    stack -> live_blocks += 1;
+    return ( slot + probe ) % PROFILE_STACKS + 1;
   }
+  return 0;
+}
 
-  return;
+//Take a freed block's sample off its stack
+static void profile_release( int node )
+{
+  if( nodes[ node ].pid == getpid( ) )
+  {
+    struct Stack * stack = &stacks[ nodes[ node ].stack - 1 ];
+
+    stack -> live_bytes  -= nodes[ node ].weight;
+    stack -> live_blocks -= 1;
+  }
+  nodes[ node ].stack = 0;
 }
 
+// Start sampling about one allocation per sample_bytes bytes
+int mavalloc_profile_start( size_t sample_bytes )
+{
+  if( sample_bytes == 0 )
+  {
+    return -1;
+  }
+
+  // Blocks sampled before a restart would refer to the cleared table
+  if( header != NULL && lock_arena( ) == 0 )
+  {
+    for( int node = header -> head; node != NIL; node = nodes[ node ].next )
+    {
+      nodes[ node ].stack = 0;
+    }
+    unlock_arena( );
+  }
+
+  memset( stacks, 0, sizeof( stacks ) );
+  profile_rate = ( double ) sample_bytes;
+  bytes_until_sample = next_sample_gap( );
+  return 0;
+}
+
+// Stop sampling. What was recorded is kept for mavalloc_profile_dump.
+void mavalloc_profile_stop( )
+{
+  profile_rate = 0;
+  bytes_until_sample = INT64_MAX;
+}
+
+//Name of a frame for a collapsed stack: the function if the symbol table
+//has it, otherwise the address
+static void frame_name( char * symbol, void * frame, char * name, size_t length )
+{
+  char * open  = symbol ? strchr( symbol, '(' ) : NULL;
+  char * end   = open ? strpbrk( open + 1, "+)" ) : NULL;
+
+  if( open && end && end > open + 1 )
+  {
+    snprintf( name, length, "%.*s", ( int ) ( end - open - 1 ), open + 1 );
+  }
+  else
+  {
+    snprintf( name, length, "%p", frame );
+  }
+}
+
+// Write live sampled bytes per stack in collapsed stack format
+int mavalloc_profile_dump( int fd )
+{
+  char name[ 256 ];
+  int i, j;
+
+  for( i = 0; i < PROFILE_STACKS; i++ )
+  {
+    struct Stack * stack = &stacks[ i ];
+
+    if( stack -> depth == 0 || stack -> live_blocks == 0 )
+    {
+      continue;
+    }
+
+    char ** symbols = backtrace_symbols( stack -> frames, stack -> depth );
+
+    // Outermost frame first
+    for( j = stack -> depth - 1; j >= 0; j-- )
+    {
+      frame_name( symbols ? symbols[ j ] : NULL, stack -> frames[ j ], name, sizeof( name ) );
+      if( dprintf( fd, "%s%c", name, j > 0 ? ';' : ' ' ) < 0 )
+      {
+        free( symbols );
+        return -1;
+      }
+    }
+    free( symbols );
+
+    if( dprintf( fd, "%llu\n", ( unsigned long long ) stack -> live_bytes ) < 0 )
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+//Place and split a block according to its expected lifetime. caller is the
+//return address of the public entry point, used as the call site.
+static void * allocate( size_t size, enum LIFETIME lifetime, void * caller )
+{
+  size_t aligned_size = ALIGN4( size );
+  void * ptr  = NULL;
+  int    slot = -1;
+  int    node;
+
+  if( header == NULL || lock_arena( ) != 0 )
+  {
+    return NULL;
+  }
+
+  uint64_t now = header -> clock++;
+
+  if( lifetime == LIFETIME_AUTO )
+  {
+    slot = site_slot( caller );
+    lifetime = learned_lifetime( slot );
+  }
+
+  if( lifetime == LIFETIME_SHORT )
+  {
+    node = place_high( aligned_size );
+    if( node != NIL )
+    {
+      node = assign_high( node, aligned_size );
+    }
+  }
+  else
+  {
+    node = ( lifetime == LIFETIME_LONG ) ? place_first_fit( aligned_size ) : place( aligned_size );
+    if( node != NIL )
+    {
+      assign_leftover( node, aligned_size );
+    }
+  }
+
+  if( adaptive )
+  {
+    adapt( node == NIL );
+  }
+
+  if( node != NIL )
+  {
+    // Site slots are private to this process, so blocks in a shared arena
+    // are never sampled
+    if( slot >= 0 && ( now & LIFETIME_SAMPLE_MASK ) == 0 && shared_lock == NULL )
+    {
+      nodes[ node ].site  = slot + 1;
+      nodes[ node ].birth = now;
+    }
+
+    if( ( bytes_until_sample -= aligned_size ) < 0 )
+    {
+      nodes[ node ].stack = profile_sample( aligned_size, caller, &nodes[ node ].weight );
+      nodes[ node ].pid   = getpid( );
+    }
+    ptr = arena + nodes[ node ].offset;
+  }
+
+  unlock_arena( );
+  return ptr;
+}
+
+// mavalloc_alloc function will allocate size bytes from preallocated memory arena using the
+// heap allocation algorithm that was specified during mavalloc_init. 
+// This function returns a pointer to the memory on success and NULL on failure. 
+void * mavalloc_alloc( size_t size )
+{
+  return allocate( size, LIFETIME_UNKNOWN, __builtin_return_address( 0 ) );
+}
+
+// Allocate with a hint about how long the block will live. Short lived blocks
+// are taken from the top of the arena, long lived ones from the bottom.
+void * mavalloc_alloc_hint( size_t size, enum LIFETIME lifetime )
+{
+  return allocate( size, lifetime, __builtin_return_address( 0 ) );
+}
+
+// This function will free the block pointed by the pointer back to preallocated memory arena.
+// Adjacent free blocks are combined. This function returns no value.  
+void mavalloc_free( void * ptr )
+{
+  if( header == NULL || ptr == NULL )
+  {
+    return;
+  }
+
+  uint64_t offset = ( char * ) ptr - arena;
+
+  if( lock_arena( ) != 0 )
+  {
+    return;
+  }
+
+  int node = header -> head;
+
+  // find the node the pointer belongs to
+  while ( node != NIL && !( nodes[ node ].offset == offset && nodes[ node ].type == USED ) )
+  {
+    node = nodes[ node ].next;
+  }
+
+  if ( node == NIL )
+  {
+    unlock_arena( );
+    return;
+  }
+
+  nodes[ node ].type = FREE;
+
+  // feed the lifetime of a sampled block back to its call site
+  if ( nodes[ node ].site != 0 )
+  {
+    struct Site * site = &sites[ nodes[ node ].site - 1 ];
+
+    site -> samples++;
+    site -> total_lifetime += header -> clock - nodes[ node ].birth;
+    nodes[ node ].site = 0;
+  }
+
+  if ( nodes[ node ].stack != 0 )
+  {
+    profile_release( node );
+  }
+
+  // combine with the free neighbours on either side
+  if ( nodes[ node ].next != NIL && nodes[ nodes[ node ].next ].type == FREE )
+  {
+    absorb_next( node );
+  }
+
+  if ( nodes[ node ].prev != NIL && nodes[ nodes[ node ].prev ].type == FREE )
+  {
+    absorb_next( nodes[ node ].prev );
+  }
+
+  unlock_arena( );
+  return;
+}
 
 // mavalloc_size() to return the number of nodes in the memory area
 int mavalloc_size( )
 {
   int number_of_nodes = 0;
-  struct Node * ptr = alloc_list;
 
-  while( ptr )
+  if( header == NULL || lock_arena( ) != 0 )
+  {
+    return 0;
+  }
+
+  int node = header -> head;
+
+  while( node != NIL )
   {
     number_of_nodes ++;
-    ptr = ptr -> next; 
+    node = nodes[ node ].next; 
   }
 
+  unlock_arena( );
   return number_of_nodes;
 }
+
+// Offset of ptr from the start of the arena
+size_t mavalloc_offset( void * ptr )
+{
+  return ( char * ) ptr - arena;
+}
+
+// Pointer for an offset returned by mavalloc_offset
+void * mavalloc_pointer( size_t offset )
+{
+  return arena + offset;
+}
+
+// The algorithm currently placing blocks; for ADAPTIVE, the one chosen for
+// the current window
+enum ALGORITHM mavalloc_algorithm( )
+{
+  return active_algorithm;
+}
+
+//write() all of length bytes
+static int write_all( int fd, const void * data, size_t length )
+{
+  const char * p = ( const char * ) data;
+
+  while( length > 0 )
+  {
+    ssize_t written = write( fd, p, length );
+
+    if( written < 0 )
+    {
+      if( errno == EINTR ) continue;
+      return -1;
+    }
+    p      += written;
+    length -= written;
+  }
+  return 0;
+}
+
+// Stream the block layout to fd
+int mavalloc_snapshot( int fd )
+{
+  struct mavalloc_snapshot_header snapshot;
+  struct mavalloc_snapshot_record * records = NULL;
+  size_t count    = 0;
+  size_t capacity = 0;
+  int node;
+
+  if( header == NULL || lock_arena( ) != 0 )
+  {
+    return -1;
+  }
+
+  memset( &snapshot, 0, sizeof( snapshot ) );
+  memcpy( snapshot.magic, MAVALLOC_SNAPSHOT_MAGIC, sizeof( MAVALLOC_SNAPSHOT_MAGIC ) );
+  snapshot.version    = MAVALLOC_SNAPSHOT_VERSION;
+  snapshot.algorithm  = header -> algorithm;
+  snapshot.arena_size = header -> arena_size;
+
+  // Copy under the lock, write after releasing it
+  for( node = header -> head; node != NIL; node = nodes[ node ].next )
+  {
+    if( count == capacity )
+    {
+      size_t grown_capacity = capacity ? capacity * 2 : 1024;
+      struct mavalloc_snapshot_record * grown = ( struct mavalloc_snapshot_record * )
+          realloc( records, grown_capacity * sizeof( *records ) );
+
+      if( grown == NULL )
+      {
+        unlock_arena( );
+        free( records );
+        return -1;
+      }
+      records  = grown;
+      capacity = grown_capacity;
+    }
+
+    struct mavalloc_snapshot_record * record = &records[ count++ ];
+
+    record -> offset   = nodes[ node ].offset;
+    record -> size     = nodes[ node ].size;
+    record -> used     = nodes[ node ].type == USED;
+    record -> reserved = 0;
+    record -> site     = 0;
+
+    if( nodes[ node ].stack != 0 && nodes[ node ].pid == getpid( ) )
+    {
+      record -> site = ( uintptr_t ) stacks[ nodes[ node ].stack - 1 ].frames[ 0 ];
+    }
+  }
+
+  unlock_arena( );
+
+  snapshot.count = count;
+
+  int rc = 0;
+  if( write_all( fd, &snapshot, sizeof( snapshot ) ) != 0 ||
+      write_all( fd, records, count * sizeof( *records ) ) != 0 )
+  {
+    rc = -1;
+  }
+
+  free( records );
+  return rc;
+}
+
+// Record the block a reopened arena should start from
+void mavalloc_set_root( void * ptr )
+{
+  if( header != NULL && lock_arena( ) == 0 )
+  {
+    header -> root = ( ptr == NULL ) ? 0 : mavalloc_offset( ptr ) + 1;
+    unlock_arena( );
+  }
+}
+
+// The block recorded by mavalloc_set_root, or NULL
+void * mavalloc_root( )
+{
+  void * root = NULL;
+
+  if( header != NULL && lock_arena( ) == 0 )
+  {
+    if( header -> root != 0 )
+    {
+      root = mavalloc_pointer( header -> root - 1 );
+    }
+    unlock_arena( );
+  }
+  return root;
+}
+
+// Flush a file backed arena to disk
+int mavalloc_sync( )
+{
+  if( mapping == NULL || shared_lock != NULL )
+  {
+    return 0;
+  }
+  return msync( mapping, mapping_size, MS_SYNC ) == 0 ? 0 : -1;
+}
@@ -21,9 +21,15 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#ifndef MAVALLOC_H
+#define MAVALLOC_H
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define ALIGN4(s)  (((((s) - 1) >> 2) << 2) + 4)
 
 enum ALGORITHM
@@ -31,9 +37,44 @@ enum ALGORITHM
   FIRST_FIT = 0,
   NEXT_FIT,
   BEST_FIT,
-  WORST_FIT
+  WORST_FIT,
+  ADAPTIVE
 }; 
 
+enum LIFETIME
+{
+  LIFETIME_UNKNOWN = 0,
+  LIFETIME_SHORT,
+  LIFETIME_LONG,
+  LIFETIME_AUTO
+};
+
+/*
+ * Snapshot file format written by mavalloc_snapshot: a snapshot header
+ * followed by count block records in address order. All fields are in the
+ * writer's byte order.
+ */
+#define MAVALLOC_SNAPSHOT_MAGIC    "MAVSNAP"
+#define MAVALLOC_SNAPSHOT_VERSION  1
+
+struct mavalloc_snapshot_header
+{
+  char               magic[ 8 ];
+  unsigned int       version;
+  unsigned int       algorithm;     // enum ALGORITHM the arena was set up with
+  unsigned long long arena_size;
+  unsigned long long count;         // number of block records that follow
+};
+
+struct mavalloc_snapshot_record
+{
+  unsigned long long offset;
+  unsigned long long size;
+  unsigned long long site;          // caller address if the profiler sampled it, else 0
+  unsigned int       used;          // 1 allocated, 0 free
+  unsigned int       reserved;
+};
+
 /**
  * @brief Initialize the allocation arena and set the algorithm type
  *
@@ -43,6 +84,11 @@ enum ALGORITHM
  * If the allocation succeeds it returns 0. If the allocation fails or the 
  * size is less than 0 the function returns -1
  *
+ * ADAPTIVE starts with first fit and, every 256 allocations, looks at how
+ * many nodes the searches visited, how many allocations failed and how
+ * fragmented the free space is, and switches between first, next and best
+ * fit to suit the workload's current phase.
+ *
  * \param size The size of the pool to allocate in bytes
  * \param algorithm The heap algorithm to implement
  * \return 0 on success. -1 on failure
@@ -77,6 +123,31 @@ void mavalloc_destroy( );
 void * mavalloc_alloc( size_t size );
 
 
+/**
+ * @brief Allocate memory from the arena with a lifetime hint
+ *
+ * Like mavalloc_alloc, but the caller says how long the block is expected
+ * to live so short and long lived blocks end up in different parts of the
+ * arena and churn in one does not fragment the other.
+ *
+ * LIFETIME_SHORT blocks are cut from the highest free block that fits,
+ * working down from the end of the arena. LIFETIME_LONG blocks are placed
+ * first fit from the start of the arena. LIFETIME_UNKNOWN uses the
+ * algorithm given to mavalloc_init, exactly like mavalloc_alloc.
+ *
+ * LIFETIME_AUTO learns from the call site: a sample of the blocks
+ * allocated from each site is timed from allocation to free, counted in
+ * allocations, and sites whose blocks die young are placed as
+ * LIFETIME_SHORT. Until a site has enough samples it is treated as
+ * LIFETIME_UNKNOWN. Statistics are kept per process and blocks in a
+ * shared memory arena are not sampled.
+ *
+ * \param size The number of bytes to allocate
+ * \param lifetime The expected lifetime of the block
+ * \return A pointer to the available memory or NULL if no free block is found
+ **/
+void * mavalloc_alloc_hint( size_t size, enum LIFETIME lifetime );
+
 /*
  * \brief free the pointer
  *
@@ -98,3 +169,197 @@ void mavalloc_free(void *ptr);
  */
 int mavalloc_size( );
 
+/*
+ * \brief The algorithm in use
+ *
+ * For ADAPTIVE this is the algorithm chosen for the current window.
+ *
+ * \return the active placement algorithm
+ */
+enum ALGORITHM mavalloc_algorithm( );
+
+/**
+ * @brief Initialize a file backed arena
+ *
+ * Maps the file at path as the arena. The allocation list is stored in the
+ * file next to the arena, using offsets instead of pointers, so a later
+ * process can map the same file and carry on where the last one stopped
+ * without rebuilding anything.
+ *
+ * A missing or empty file is sized to fit size bytes plus the allocation
+ * list. If it already holds an arena, size is ignored and the existing
+ * arena is reopened with the given algorithm. Any other file, including an
+ * arena written by a different MAVALLOC_VERSION, is never overwritten.
+ * The file reserves room for one list node per 256 arena bytes; once that
+ * runs out free blocks are handed out whole instead of being split.
+ *
+ * The mapping may land at a different address each time, so data kept in
+ * the arena should link blocks with mavalloc_offset / mavalloc_pointer and
+ * record its entry point with mavalloc_set_root.
+ *
+ * mavalloc_destroy flushes and unmaps the arena but keeps the file.
+ *
+ * \param path The arena file
+ * \param size The size of a new arena in bytes
+ * \param algorithm The heap algorithm to implement
+ * \return 0 if a new arena was created, 1 if an existing one was reopened,
+ *         -1 on failure, or if the file is not an arena of this version or
+ *         its allocation list is damaged
+ **/
+int mavalloc_init_file( const char * path, size_t size, enum ALGORITHM algorithm );
+
+/**
+ * @brief Create or attach to an arena in POSIX shared memory
+ *
+ * The first caller creates the shared memory object called name (see
+ * shm_open), sized for size bytes plus the allocation list, and sets up a
+ * process shared robust mutex inside it. Later callers, in any process,
+ * attach to the same object and size is ignored. From then on
+ * mavalloc_alloc, mavalloc_free and friends in every attached process work
+ * on the one arena under that mutex.
+ *
+ * Each process maps the arena at its own address, so blocks are passed
+ * between processes as mavalloc_offset values and turned back into
+ * pointers with mavalloc_pointer. A child forked after this call is
+ * already attached.
+ *
+ * If a process dies holding the lock, the next caller checks the
+ * allocation list and carries on if it is intact. If it is not, every
+ * later call on the arena fails.
+ *
+ * mavalloc_destroy only detaches the calling process. The object lives on
+ * until mavalloc_unlink_shared removes its name and the last process
+ * detaches.
+ *
+ * \param name The shared memory object name, starting with '/'
+ * \param size The size of a new arena in bytes
+ * \param algorithm The heap algorithm this process uses
+ * \return 0 if the arena was created, 1 if an existing one was attached,
+ *         -1 on failure
+ **/
+int mavalloc_init_shared( const char * name, size_t size, enum ALGORITHM algorithm );
+
+/*
+ * \brief Remove the name of a shared memory arena
+ *
+ * \param name The name passed to mavalloc_init_shared
+ *
+ * \return 0 on success, -1 on failure
+ */
+int mavalloc_unlink_shared( const char * name );
+
+/**
+ * @brief Start the sampling heap profiler
+ *
+ * From now on about one allocation per sample_bytes allocated bytes has
+ * its call stack recorded. Allocations that are not sampled only pay for
+ * a counter update, so the profiler can stay on in production. Each
+ * sample is weighted by the inverse of its chance of being picked, and
+ * freeing a sampled block takes its weight back off its stack, so the
+ * profile estimates the bytes each call path is holding right now.
+ *
+ * Starting again clears everything recorded so far. Stacks are recorded
+ * per process; in a shared arena a block sampled by one process and freed
+ * by another stays counted by the first.
+ *
+ * \param sample_bytes Mean number of bytes between samples
+ * \return 0 on success, -1 if sample_bytes is 0
+ **/
+int mavalloc_profile_start( size_t sample_bytes );
+
+/*
+ * \brief Stop sampling
+ *
+ * Blocks already sampled stay in the profile until they are freed.
+ *
+ * \return none
+ */
+void mavalloc_profile_stop( );
+
+/*
+ * \brief Write the heap profile
+ *
+ * Writes one line per call stack that still holds sampled memory, in the
+ * collapsed stack format read by flamegraph.pl, speedscope and pprof:
+ * frames from outermost to innermost separated by ';', a space, then the
+ * estimated live bytes. Frames without a symbol are written as addresses;
+ * link with -rdynamic to get function names.
+ *
+ * \param fd The file descriptor to write to
+ *
+ * \return 0 on success, -1 if writing failed
+ */
+int mavalloc_profile_dump( int fd );
+
+/**
+ * @brief Write a snapshot of the arena layout
+ *
+ * Writes a mavalloc_snapshot_header and one mavalloc_snapshot_record for
+ * every block, free or allocated, in address order. The allocation site
+ * is filled in for blocks the heap profiler sampled.
+ *
+ * The block list is copied in one pass while the arena is locked and
+ * written out after the lock is released, so other users of a shared
+ * arena only wait for the copy, not the I/O. The mavsnap tool turns
+ * snapshots into fragmentation maps and free size histograms.
+ *
+ * \param fd The file descriptor to write to
+ * \return 0 on success, -1 on failure
+ **/
+int mavalloc_snapshot( int fd );
+
+/*
+ * \brief Flush a file backed arena
+ *
+ * Writes the arena and its allocation list back to the file. Does nothing
+ * for a heap or shared memory arena.
+ *
+ * \return 0 on success, -1 on failure
+ */
+int mavalloc_sync( );
+
+/*
+ * \brief Offset of a block from the start of the arena
+ *
+ * Offsets stay valid when a file backed arena is mapped again at a
+ * different address.
+ *
+ * \param ptr memory returned by mavalloc_alloc
+ *
+ * \return the offset of ptr in the arena
+ */
+size_t mavalloc_offset( void * ptr );
+
+/*
+ * \brief Pointer for an arena offset
+ *
+ * \param offset an offset from mavalloc_offset
+ *
+ * \return the address of offset in the current mapping
+ */
+void * mavalloc_pointer( size_t offset );
+
+/*
+ * \brief Record the root block of the arena
+ *
+ * The root is stored with the arena so it can be found again after a file
+ * backed arena is reopened. Pass NULL to clear it.
+ *
+ * \param ptr memory returned by mavalloc_alloc, or NULL
+ *
+ * \return none
+ */
+void mavalloc_set_root( void * ptr );
+
+/*
+ * \brief The root block of the arena
+ *
+ * \return the block recorded by mavalloc_set_root, or NULL if none
+ */
+void * mavalloc_root( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
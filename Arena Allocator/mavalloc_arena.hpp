@@ -0,0 +1,385 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2022 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Compile-time specialised arena for C++17.
+//
+//   mavalloc::Arena<Policy, Alignment, SizeClasses>
+//
+// Policy is one of first_fit, next_fit, best_fit or worst_fit. Alignment is
+// the alignment of every block handed out. SizeClasses is a size_classes<...>
+// list that requests are rounded up to; the rounding goes through a constexpr
+// lookup table. All three are fixed by the type, so allocate() has no
+// runtime policy branch and the search loop inlines into the caller.
+//
+// Unlike the C arena, each Arena object owns its own memory, and every block
+// carries a small header pointing at its node so deallocate() is O(1).
+
+#ifndef MAVALLOC_ARENA_HPP
+#define MAVALLOC_ARENA_HPP
+
+#include "mavalloc.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace mavalloc {
+
+/**
+ * @brief Ascending list of size classes requests are rounded up to
+ *
+ * Requests larger than the largest class are only rounded to the alignment.
+ * size_classes<> disables rounding to classes.
+ **/
+template <std::size_t... Sizes>
+struct size_classes
+{
+  static constexpr std::size_t count   = sizeof...( Sizes );
+  static constexpr std::size_t largest = std::max( { std::size_t( 0 ), Sizes... } );
+  static constexpr std::size_t sizes[ count + 1 ] = { Sizes..., 0 };
+
+  static constexpr bool sorted( )
+  {
+    for( std::size_t i = 1; i < count; i++ )
+    {
+      if( sizes[ i - 1 ] >= sizes[ i ] )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Placement policies. find() returns the free node a request of size bytes
+// goes in, or nullptr. cursor is the node of the previous allocation.
+
+struct first_fit
+{
+  template <class Node>
+  static Node * find( Node * head, Node *, std::size_t size )
+  {
+    for( Node * node = head; node; node = node -> next )
+    {
+      if( !node -> used && node -> size >= size )
+      {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+};
+
+struct next_fit
+{
+  template <class Node>
+  static Node * find( Node * head, Node * cursor, std::size_t size )
+  {
+    Node * node = cursor ? cursor : head;
+    Node * stop = node;
+    do
+    {
+      if( !node -> used && node -> size >= size )
+      {
+        return node;
+      }
+      node = node -> next ? node -> next : head;
+    } while( node != stop );
+    return nullptr;
+  }
+};
+
+struct best_fit
+{
+  template <class Node>
+  static Node * find( Node * head, Node *, std::size_t size )
+  {
+    Node * best = nullptr;
+    for( Node * node = head; node; node = node -> next )
+    {
+      if( !node -> used && node -> size >= size && ( !best || node -> size < best -> size ) )
+      {
+        best = node;
+      }
+    }
+    return best;
+  }
+};
+
+struct worst_fit
+{
+  template <class Node>
+  static Node * find( Node * head, Node *, std::size_t size )
+  {
+    Node * worst = nullptr;
+    for( Node * node = head; node; node = node -> next )
+    {
+      if( !node -> used && ( !worst || node -> size > worst -> size ) )
+      {
+        worst = node;
+      }
+    }
+    return ( worst && worst -> size >= size ) ? worst : nullptr;
+  }
+};
+
+/**
+ * @brief Maps the C enum ALGORITHM onto a policy type
+ **/
+template <ALGORITHM A> struct policy_for;
+template <> struct policy_for<FIRST_FIT> { typedef first_fit type; };
+template <> struct policy_for<NEXT_FIT>  { typedef next_fit  type; };
+template <> struct policy_for<BEST_FIT>  { typedef best_fit  type; };
+template <> struct policy_for<WORST_FIT> { typedef worst_fit type; };
+
+template <class Policy, std::size_t Alignment = 4, class SizeClasses = size_classes<> >
+class Arena
+{
+  static_assert( Alignment != 0 && ( Alignment & ( Alignment - 1 ) ) == 0,
+                 "Alignment must be a power of two" );
+  static_assert( SizeClasses::sorted( ), "size classes must be strictly ascending" );
+
+public:
+  struct Node
+  {
+    std::size_t size;    // bytes including the block header
+    bool        used;
+    char *      base;
+    Node *      next;
+    Node *      prev;
+  };
+
+  static constexpr std::size_t alignment   = Alignment;
+  static constexpr std::size_t header_size =
+      ( sizeof( Node * ) + Alignment - 1 ) & ~( Alignment - 1 );
+
+  /**
+   * @brief Create an arena of size bytes
+   *
+   * Throws std::bad_alloc if the memory cannot be obtained.
+   **/
+  explicit Arena( std::size_t size )
+  {
+    size_ = align_up( size );
+    memory_ = static_cast<char *>( ::operator new( size_, std::align_val_t( buffer_alignment ) ) );
+    head_ = new_node( memory_, size_, nullptr, nullptr );
+    cursor_ = head_;
+  }
+
+  ~Arena( )
+  {
+    Node * node = head_;
+    while( node )
+    {
+      Node * next = node -> next;
+      delete node;
+      node = next;
+    }
+    node = spare_;
+    while( node )
+    {
+      Node * next = node -> next;
+      delete node;
+      node = next;
+    }
+    ::operator delete( memory_, std::align_val_t( buffer_alignment ) );
+  }
+
+  Arena( const Arena & ) = delete;
+  Arena & operator=( const Arena & ) = delete;
+
+  /**
+   * @brief Round a request to its size class or to the alignment
+   **/
+  static constexpr std::size_t round( std::size_t size )
+  {
+    if constexpr ( SizeClasses::count != 0 )
+    {
+      if( size <= SizeClasses::largest )
+      {
+        return class_table[ ( size + Alignment - 1 ) / Alignment ];
+      }
+    }
+    return align_up( size );
+  }
+
+  /**
+   * @brief Allocate size bytes, or return nullptr if no free block fits
+   **/
+  void * allocate( std::size_t size )
+  {
+    // Rounding and adding the header would wrap these around to small sizes
+    if( size > SIZE_MAX - header_size - Alignment )
+    {
+      return nullptr;
+    }
+
+    std::size_t need = round( size ) + header_size;
+    Node * node = Policy::find( head_, cursor_, need );
+
+    if( node == nullptr )
+    {
+      return nullptr;
+    }
+
+    // Only split if the leftover can hold a header and a minimal payload
+    if( node -> size - need >= header_size + Alignment )
+    {
+      Node * rest = new_node( node -> base + need, node -> size - need, node, node -> next );
+      if( node -> next )
+      {
+        node -> next -> prev = rest;
+      }
+      node -> next = rest;
+      node -> size = need;
+    }
+
+    node -> used = true;
+    cursor_ = node;
+
+    // The header is only Alignment aligned, which can be less than a pointer
+    std::memcpy( node -> base, &node, sizeof( node ) );
+    return node -> base + header_size;
+  }
+
+  /**
+   * @brief Return a block to the arena, merging it with free neighbours
+   **/
+  void deallocate( void * ptr )
+  {
+    if( ptr == nullptr )
+    {
+      return;
+    }
+
+    Node * node;
+    std::memcpy( &node, static_cast<char *>( ptr ) - header_size, sizeof( node ) );
+    node -> used = false;
+
+    if( node -> next && !node -> next -> used )
+    {
+      absorb_next( node );
+    }
+    if( node -> prev && !node -> prev -> used )
+    {
+      node = node -> prev;
+      absorb_next( node );
+    }
+  }
+
+  /**
+   * @brief Number of nodes in the block list, as mavalloc_size
+   **/
+  int size( ) const
+  {
+    int count = 0;
+    for( Node * node = head_; node; node = node -> next )
+    {
+      count++;
+    }
+    return count;
+  }
+
+private:
+  static constexpr std::size_t buffer_alignment =
+      Alignment > alignof( std::max_align_t ) ? Alignment : alignof( std::max_align_t );
+
+  static constexpr std::size_t align_up( std::size_t size )
+  {
+    return ( size + Alignment - 1 ) & ~( Alignment - 1 );
+  }
+
+  typedef std::array<std::size_t, SizeClasses::largest / Alignment + 2> table_type;
+
+  // class_table[ k ] is the smallest class holding k * Alignment bytes
+  static constexpr table_type make_class_table( )
+  {
+    table_type table { };
+    std::size_t c = 0;
+    for( std::size_t k = 0; k < table.size( ); k++ )
+    {
+      while( c < SizeClasses::count && SizeClasses::sizes[ c ] < k * Alignment )
+      {
+        c++;
+      }
+      table[ k ] = c < SizeClasses::count ? align_up( SizeClasses::sizes[ c ] ) : align_up( k * Alignment );
+    }
+    return table;
+  }
+
+  static constexpr table_type class_table = make_class_table( );
+
+  Node * new_node( char * base, std::size_t size, Node * prev, Node * next )
+  {
+    Node * node = spare_;
+    if( node )
+    {
+      spare_ = node -> next;
+    }
+    else
+    {
+      node = new Node;
+    }
+    node -> base = base;
+    node -> size = size;
+    node -> used = false;
+    node -> prev = prev;
+    node -> next = next;
+    return node;
+  }
+
+  void absorb_next( Node * node )
+  {
+    Node * absorbed = node -> next;
+    node -> size += absorbed -> size;
+    node -> next  = absorbed -> next;
+    if( node -> next )
+    {
+      node -> next -> prev = node;
+    }
+    if( cursor_ == absorbed )
+    {
+      cursor_ = node;
+    }
+    absorbed -> next = spare_;
+    spare_ = absorbed;
+  }
+
+  char *      memory_ = nullptr;
+  std::size_t size_   = 0;
+  Node *      head_   = nullptr;
+  Node *      cursor_ = nullptr;
+  Node *      spare_  = nullptr;
+};
+
+/**
+ * @brief The instantiation matching the C API defaults
+ **/
+typedef Arena<first_fit, 4> default_arena;
+
+}
+
+#endif
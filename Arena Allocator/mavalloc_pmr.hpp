@@ -0,0 +1,379 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2022 Trevor Bakker
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Header-only C++17 layer that exposes the mavalloc arena as
+// std::pmr::memory_resource so standard containers can live in it.
+//
+//   mavalloc::arena                      RAII owner of the arena
+//   mavalloc::arena_resource             every request goes to mavalloc_alloc
+//   mavalloc::monotonic_arena_resource   bump allocation, freed all at once
+//   mavalloc::pool_arena_resource        free lists keyed by size class
+//
+// mavalloc keeps one arena per process, so only one mavalloc::arena may be
+// alive at a time and every resource draws from that arena.
+
+#ifndef MAVALLOC_PMR_HPP
+#define MAVALLOC_PMR_HPP
+
+#include "mavalloc.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+
+namespace mavalloc {
+
+/**
+ * @brief RAII ownership of the process arena
+ *
+ * Calls mavalloc_init on construction and mavalloc_destroy on destruction.
+ * Throws std::bad_alloc if the arena cannot be created.
+ **/
+class arena
+{
+public:
+  explicit arena( std::size_t size, ALGORITHM algorithm = FIRST_FIT )
+  {
+    if( mavalloc_init( size, algorithm ) != 0 )
+    {
+      throw std::bad_alloc( );
+    }
+  }
+
+  ~arena( )
+  {
+    mavalloc_destroy( );
+  }
+
+  arena( const arena & ) = delete;
+  arena & operator=( const arena & ) = delete;
+};
+
+/**
+ * @brief General purpose resource over mavalloc_alloc / mavalloc_free
+ *
+ * mavalloc only guarantees 4 byte alignment. Stricter requests are padded and
+ * the pointer mavalloc returned is stored in the word just below the block
+ * handed out, so deallocate can give the right pointer back.
+ **/
+class arena_resource : public std::pmr::memory_resource
+{
+public:
+  static constexpr std::size_t native_alignment = 4;
+
+protected:
+  void * do_allocate( std::size_t bytes, std::size_t alignment ) override
+  {
+    if( bytes == 0 )
+    {
+      bytes = 1;
+    }
+
+    if( alignment <= native_alignment )
+    {
+      void * ptr = mavalloc_alloc( bytes );
+      if( ptr == nullptr )
+      {
+        throw std::bad_alloc( );
+      }
+      return ptr;
+    }
+
+    void * raw = mavalloc_alloc( bytes + alignment + sizeof( void * ) );
+    if( raw == nullptr )
+    {
+      throw std::bad_alloc( );
+    }
+
+    std::uintptr_t start   = reinterpret_cast<std::uintptr_t>( raw ) + sizeof( void * );
+    std::uintptr_t aligned = ( start + alignment - 1 ) & ~( std::uintptr_t )( alignment - 1 );
+
+    reinterpret_cast<void **>( aligned )[ -1 ] = raw;
+    return reinterpret_cast<void *>( aligned );
+  }
+
+  void do_deallocate( void * ptr, std::size_t, std::size_t alignment ) override
+  {
+    if( alignment <= native_alignment )
+    {
+      mavalloc_free( ptr );
+    }
+    else
+    {
+      mavalloc_free( static_cast<void **>( ptr )[ -1 ] );
+    }
+  }
+
+  // There is a single arena, so any two arena_resources can free each
+  // other's memory
+  bool do_is_equal( const std::pmr::memory_resource & other ) const noexcept override
+  {
+    return dynamic_cast<const arena_resource *>( &other ) != nullptr;
+  }
+};
+
+/**
+ * @brief Bump allocator for scratch regions
+ *
+ * Carves requests out of large chunks taken from the arena. Deallocation is
+ * a no-op; all chunks go back to the arena on release() or destruction. When
+ * a chunk runs out the next one is twice as large.
+ **/
+class monotonic_arena_resource : public std::pmr::memory_resource
+{
+public:
+  explicit monotonic_arena_resource( std::size_t initial_size = 4096 )
+    : next_size_( initial_size < 64 ? 64 : initial_size )
+  {
+  }
+
+  ~monotonic_arena_resource( ) override
+  {
+    release( );
+  }
+
+  monotonic_arena_resource( const monotonic_arena_resource & ) = delete;
+  monotonic_arena_resource & operator=( const monotonic_arena_resource & ) = delete;
+
+  /**
+   * @brief Return every chunk to the arena
+   *
+   * Invalidates all memory handed out by this resource.
+   **/
+  void release( )
+  {
+    while( chunks_ != nullptr )
+    {
+      void * next;
+      std::memcpy( &next, chunks_, sizeof( next ) );
+      mavalloc_free( chunks_ );
+      chunks_ = next;
+    }
+    current_ = nullptr;
+    end_     = nullptr;
+  }
+
+protected:
+  void * do_allocate( std::size_t bytes, std::size_t alignment ) override
+  {
+    char * ptr = align_up( current_, alignment );
+
+    if( ptr == nullptr || ptr + bytes > end_ )
+    {
+      grow( bytes + alignment );
+      ptr = align_up( current_, alignment );
+    }
+
+    current_ = ptr + bytes;
+    return ptr;
+  }
+
+  void do_deallocate( void *, std::size_t, std::size_t ) override
+  {
+  }
+
+  bool do_is_equal( const std::pmr::memory_resource & other ) const noexcept override
+  {
+    return this == &other;
+  }
+
+private:
+  // Each chunk starts with a pointer to the chunk before it. mavalloc only
+  // aligns chunks to 4 bytes, so the pointer is copied in and out.
+  static constexpr std::size_t header_size = sizeof( void * );
+
+  static char * align_up( char * ptr, std::size_t alignment )
+  {
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>( ptr );
+    p = ( p + alignment - 1 ) & ~( std::uintptr_t )( alignment - 1 );
+    return reinterpret_cast<char *>( p );
+  }
+
+  void grow( std::size_t minimum )
+  {
+    std::size_t size = next_size_;
+    while( size < minimum + header_size )
+    {
+      size *= 2;
+    }
+
+    char * c = static_cast<char *>( mavalloc_alloc( size ) );
+    if( c == nullptr )
+    {
+      throw std::bad_alloc( );
+    }
+
+    std::memcpy( c, &chunks_, sizeof( chunks_ ) );
+    chunks_   = c;
+    current_  = c + header_size;
+    end_      = c + size;
+    next_size_ = size * 2;
+  }
+
+  void *      chunks_  = nullptr;
+  char *      current_ = nullptr;
+  char *      end_     = nullptr;
+  std::size_t next_size_;
+};
+
+/**
+ * @brief Size class pool on top of the arena
+ *
+ * Requests up to max_pooled bytes are rounded up to a power of two size class
+ * and served from a per class free list. Free lists are refilled a slab at a
+ * time from the arena, so mavalloc sees one large block per slab instead of
+ * one node per object. Larger requests go straight to arena_resource.
+ **/
+class pool_arena_resource : public std::pmr::memory_resource
+{
+public:
+  static constexpr std::size_t min_class    = 16;
+  static constexpr std::size_t max_pooled   = 4096;
+  static constexpr std::size_t slab_size    = 64 * 1024;
+  static constexpr std::size_t class_count  = 9;   // 16 .. 4096
+
+  pool_arena_resource( ) = default;
+
+  ~pool_arena_resource( ) override
+  {
+    release( );
+  }
+
+  pool_arena_resource( const pool_arena_resource & ) = delete;
+  pool_arena_resource & operator=( const pool_arena_resource & ) = delete;
+
+  /**
+   * @brief Return every slab to the arena
+   *
+   * Invalidates all pooled memory handed out by this resource.
+   **/
+  void release( )
+  {
+    while( slabs_ != nullptr )
+    {
+      slab * next = slabs_ -> next;
+      upstream_.deallocate( slabs_, slab_size + max_pooled, max_pooled );
+      slabs_ = next;
+    }
+    for( std::size_t i = 0; i < class_count; i++ )
+    {
+      free_lists_[ i ] = nullptr;
+    }
+  }
+
+protected:
+  void * do_allocate( std::size_t bytes, std::size_t alignment ) override
+  {
+    if( bytes > max_pooled || alignment > max_pooled )
+    {
+      return upstream_.allocate( bytes, alignment );
+    }
+
+    // Size classes are powers of two carved from max_pooled aligned slabs,
+    // so every block is naturally aligned to its own size
+    std::size_t index = class_index( bytes < alignment ? alignment : bytes );
+
+    if( free_lists_[ index ] == nullptr )
+    {
+      refill( index );
+    }
+
+    block * b = free_lists_[ index ];
+    free_lists_[ index ] = b -> next;
+    return b;
+  }
+
+  void do_deallocate( void * ptr, std::size_t bytes, std::size_t alignment ) override
+  {
+    if( bytes > max_pooled || alignment > max_pooled )
+    {
+      upstream_.deallocate( ptr, bytes, alignment );
+      return;
+    }
+
+    std::size_t index = class_index( bytes < alignment ? alignment : bytes );
+    block * b = static_cast<block *>( ptr );
+    b -> next = free_lists_[ index ];
+    free_lists_[ index ] = b;
+  }
+
+  bool do_is_equal( const std::pmr::memory_resource & other ) const noexcept override
+  {
+    return this == &other;
+  }
+
+private:
+  struct block
+  {
+    block * next;
+  };
+
+  struct slab
+  {
+    slab * next;
+  };
+
+  static std::size_t class_index( std::size_t bytes )
+  {
+    std::size_t index = 0;
+    std::size_t size  = min_class;
+    while( size < bytes )
+    {
+      size <<= 1;
+      index++;
+    }
+    return index;
+  }
+
+  void refill( std::size_t index )
+  {
+    std::size_t size = min_class << index;
+
+    // The slab header takes the first max_pooled bytes so the blocks after
+    // it keep the slab's alignment
+    char * base = static_cast<char *>(
+        upstream_.allocate( slab_size + max_pooled, max_pooled ) );
+
+    slab * s = reinterpret_cast<slab *>( base );
+    s -> next = slabs_;
+    slabs_    = s;
+
+    char * first = base + max_pooled;
+    for( std::size_t i = slab_size / size; i > 0; i-- )
+    {
+      block * b = reinterpret_cast<block *>( first + ( i - 1 ) * size );
+      b -> next = free_lists_[ index ];
+      free_lists_[ index ] = b;
+    }
+  }
+
+  arena_resource upstream_;
+  slab *         slabs_ = nullptr;
+  block *        free_lists_[ class_count ] = { };
+};
+
+}
+
+#endif
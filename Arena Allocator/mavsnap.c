@@ -0,0 +1,305 @@
+// mavsnap: summarise a snapshot written by mavalloc_snapshot
+//
+//   mavsnap <snapshot file> [map columns]
+//
+// Prints block and byte totals, a map of the arena where each character
+// covers an equal slice of it, a histogram of free block sizes and, when the
+// heap profiler was running, the allocation sites holding the most bytes.
+
+#include "mavalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_ROWS   16
+#define BUCKETS    48
+#define TOP_SITES  10
+
+static const char * algorithm_names[ ] =
+{
+  "FIRST_FIT", "NEXT_FIT", "BEST_FIT", "WORST_FIT", "ADAPTIVE"
+};
+
+struct site_total
+{
+  unsigned long long site;
+  unsigned long long bytes;
+  unsigned long long blocks;
+};
+
+// Read the whole snapshot. Returns the records, or NULL on error.
+static struct mavalloc_snapshot_record * load( const char * path,
+                                               struct mavalloc_snapshot_header * header )
+{
+  FILE * file = fopen( path, "rb" );
+  struct mavalloc_snapshot_record * records;
+
+  if( !file )
+  {
+    perror( path );
+    return NULL;
+  }
+
+  if( fread( header, sizeof( *header ), 1, file ) != 1 ||
+      memcmp( header -> magic, MAVALLOC_SNAPSHOT_MAGIC, sizeof( MAVALLOC_SNAPSHOT_MAGIC ) ) != 0 ||
+      header -> version != MAVALLOC_SNAPSHOT_VERSION )
+  {
+    fprintf( stderr, "mavsnap: %s is not a mavalloc snapshot\n", path );
+    fclose( file );
+    return NULL;
+  }
+
+  // The count comes from the file, so check it fits the file before using it
+  long end = fseek( file, 0, SEEK_END ) == 0 ? ftell( file ) : -1;
+
+  if( end < ( long ) sizeof( *header ) ||
+      header -> count > ( unsigned long long ) ( end - sizeof( *header ) ) / sizeof( *records ) ||
+      fseek( file, sizeof( *header ), SEEK_SET ) != 0 )
+  {
+    fprintf( stderr, "mavsnap: %s is truncated\n", path );
+    fclose( file );
+    return NULL;
+  }
+
+  records = ( struct mavalloc_snapshot_record * ) malloc( ( header -> count + 1 ) * sizeof( *records ) );
+
+  if( !records || fread( records, sizeof( *records ), header -> count, file ) != header -> count )
+  {
+    fprintf( stderr, "mavsnap: %s is truncated\n", path );
+    free( records );
+    fclose( file );
+    return NULL;
+  }
+
+  fclose( file );
+  return records;
+}
+
+static void print_summary( struct mavalloc_snapshot_header * header,
+                           struct mavalloc_snapshot_record * records )
+{
+  unsigned long long used_bytes = 0, free_bytes = 0, largest_free = 0;
+  unsigned long long used_blocks = 0, free_blocks = 0;
+  unsigned long long i;
+
+  for( i = 0; i < header -> count; i++ )
+  {
+    if( records[ i ].used )
+    {
+      used_blocks++;
+      used_bytes += records[ i ].size;
+    }
+    else
+    {
+      free_blocks++;
+      free_bytes += records[ i ].size;
+      if( records[ i ].size > largest_free )
+      {
+        largest_free = records[ i ].size;
+      }
+    }
+  }
+
+  printf( "arena         %llu bytes, %s\n", header -> arena_size,
+          header -> algorithm < 5 ? algorithm_names[ header -> algorithm ] : "unknown" );
+  printf( "used          %llu bytes in %llu blocks\n", used_bytes, used_blocks );
+  printf( "free          %llu bytes in %llu blocks\n", free_bytes, free_blocks );
+  printf( "largest free  %llu bytes\n", largest_free );
+  printf( "fragmentation %.1f%% of free space is outside the largest free block\n",
+          free_bytes ? 100.0 * ( 1.0 - ( double ) largest_free / free_bytes ) : 0.0 );
+}
+
+// One character per slice of the arena, by the share of the slice in use:
+// '.' none, ':' up to half, '+' over half, '#' all
+static void print_map( struct mavalloc_snapshot_header * header,
+                       struct mavalloc_snapshot_record * records, int columns )
+{
+  unsigned long long cells = ( unsigned long long ) columns * MAP_ROWS;
+  unsigned long long cell, i = 0;
+
+  if( header -> arena_size == 0 )
+  {
+    return;
+  }
+
+  printf( "\nmap (%d x %d, %.1f bytes per cell)\n", columns, MAP_ROWS,
+          ( double ) header -> arena_size / cells );
+
+  for( cell = 0; cell < cells; cell++ )
+  {
+    unsigned long long start = header -> arena_size * cell / cells;
+    unsigned long long end   = header -> arena_size * ( cell + 1 ) / cells;
+    unsigned long long used  = 0;
+    unsigned long long j;
+
+    // Records are in address order; skip those that end before this cell
+    while( i < header -> count && records[ i ].offset + records[ i ].size <= start )
+    {
+      i++;
+    }
+
+    for( j = i; j < header -> count && records[ j ].offset < end; j++ )
+    {
+      unsigned long long lo = records[ j ].offset > start ? records[ j ].offset : start;
+      unsigned long long hi = records[ j ].offset + records[ j ].size < end ?
+                              records[ j ].offset + records[ j ].size : end;
+      if( records[ j ].used && hi > lo )
+      {
+        used += hi - lo;
+      }
+    }
+
+    char c = '#';
+    if( used == 0 )                    c = '.';
+    else if( used * 2 <= end - start ) c = ':';
+    else if( used < end - start )      c = '+';
+
+    putchar( c );
+    if( ( cell + 1 ) % columns == 0 )
+    {
+      putchar( '\n' );
+    }
+  }
+}
+
+// Free blocks by power of two size
+static void print_histogram( struct mavalloc_snapshot_header * header,
+                             struct mavalloc_snapshot_record * records )
+{
+  unsigned long long counts[ BUCKETS ] = { 0 };
+  unsigned long long bytes[ BUCKETS ]  = { 0 };
+  unsigned long long most = 0;
+  unsigned long long i;
+  int b;
+
+  for( i = 0; i < header -> count; i++ )
+  {
+    if( records[ i ].used )
+    {
+      continue;
+    }
+
+    b = 0;
+    while( b < BUCKETS - 1 && ( 1ULL << ( b + 1 ) ) <= records[ i ].size )
+    {
+      b++;
+    }
+    counts[ b ]++;
+    bytes[ b ] += records[ i ].size;
+    if( counts[ b ] > most )
+    {
+      most = counts[ b ];
+    }
+  }
+
+  printf( "\nfree block sizes\n" );
+  for( b = 0; b < BUCKETS; b++ )
+  {
+    if( counts[ b ] == 0 )
+    {
+      continue;
+    }
+
+    int bar = ( int ) ( 40 * counts[ b ] / most );
+    printf( "%12llu+ %8llu blocks %12llu bytes ", 1ULL << b, counts[ b ], bytes[ b ] );
+    while( bar-- > 0 )
+    {
+      putchar( '*' );
+    }
+    putchar( '\n' );
+  }
+}
+
+static int by_bytes( const void * a, const void * b )
+{
+  const struct site_total * x = ( const struct site_total * ) a;
+  const struct site_total * y = ( const struct site_total * ) b;
+  return ( x -> bytes < y -> bytes ) - ( x -> bytes > y -> bytes );
+}
+
+// Sampled allocation sites by bytes held
+static void print_sites( struct mavalloc_snapshot_header * header,
+                         struct mavalloc_snapshot_record * records )
+{
+  struct site_total * totals = NULL;
+  size_t count = 0;
+  unsigned long long i;
+  size_t j;
+
+  for( i = 0; i < header -> count; i++ )
+  {
+    if( !records[ i ].used || records[ i ].site == 0 )
+    {
+      continue;
+    }
+
+    for( j = 0; j < count && totals[ j ].site != records[ i ].site; j++ )
+    {
+    }
+
+    if( j == count )
+    {
+      struct site_total * grown = ( struct site_total * ) realloc( totals, ( count + 1 ) * sizeof( *totals ) );
+      if( !grown )
+      {
+        break;
+      }
+      totals = grown;
+      totals[ count ].site   = records[ i ].site;
+      totals[ count ].bytes  = 0;
+      totals[ count ].blocks = 0;
+      count++;
+    }
+    totals[ j ].bytes  += records[ i ].size;
+    totals[ j ].blocks += 1;
+  }
+
+  if( count > 0 )
+  {
+    qsort( totals, count, sizeof( *totals ), by_bytes );
+
+    printf( "\nsampled allocation sites\n" );
+    for( j = 0; j < count && j < TOP_SITES; j++ )
+    {
+      printf( "  0x%llx %12llu bytes in %llu sampled blocks\n",
+              totals[ j ].site, totals[ j ].bytes, totals[ j ].blocks );
+    }
+  }
+  free( totals );
+}
+
+int main( int argc, char * argv[] )
+{
+  struct mavalloc_snapshot_header header;
+  struct mavalloc_snapshot_record * records;
+  int columns = 64;
+
+  if( argc < 2 )
+  {
+    fprintf( stderr, "Use: mavsnap <snapshot file> [map columns]\n" );
+    return 1;
+  }
+
+  if( argc > 2 )
+  {
+    columns = atoi( argv[ 2 ] );
+    if( columns <= 0 )
+    {
+      columns = 64;
+    }
+  }
+
+  records = load( argv[ 1 ], &header );
+  if( !records )
+  {
+    return 1;
+  }
+
+  print_summary( &header, records );
+  print_map( &header, records, columns );
+  print_histogram( &header, records );
+  print_sites( &header, records );
+
+  free( records );
+  return 0;
+}
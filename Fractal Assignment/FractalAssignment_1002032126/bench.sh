@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# Render a fixed set of views at each thread count and print a CSV of
+# the speed and scaling, one line per run, to stdout.
+#
+# Every image is checksummed against bench.sums, so a change that makes
+# mandel faster by drawing something else shows up as "changed" and the
+# script exits with 1. After a change that is meant to alter the images,
+# run it with UPDATE=1 to write the new sums.
+#
+# THREADS sets the thread counts to try. (default "1 2 4 8")
+
+MANDEL=${MANDEL:-./mandel}
+THREADS=${THREADS:-1 2 4 8}
+SUMS=${SUMS:-bench.sums}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# name, width and height, then the options that pick the view
+views='
+full      2000 -x -0.5 -y 0 -s 3 -m 1000
+seahorse  1000 -x -0.743643887037151 -y 0.131825904205330 -s 0.005 -m 5000
+spiral     500 -x -0.743643887037158704752191506114774 -y 0.131825904205311970493132056385139 -s 1e-20 -m 10000 -P deep
+'
+
+echo "view,threads,pixels,iterations,compute_s,write_s,total_s,mpixel_s,giter_s,efficiency,checksum,check"
+
+echo "$views" | while read -r name size options; do
+    [ -n "$name" ] || continue
+
+    base=
+    for n in $THREADS; do
+        out="$dir/$name-$n.bmp"
+
+        if ! $MANDEL $options -W "$size" -H "$size" -n "$n" -o "$out" > "$dir/log" 2>&1; then
+            echo "bench: $name with $n threads failed:" >&2
+            cat "$dir/log" >&2
+            exit 1
+        fi
+
+        sum=$(cksum < "$out" | awk '{ print $1 }')
+        expected=$(awk -v v="$name" '$1 == v { print $2 }' "$SUMS" 2>/dev/null)
+
+        if [ -n "$UPDATE" ]; then
+            check=updated
+            if [ "$n" = "$(echo $THREADS | awk '{ print $1 }')" ]; then
+                awk -v v="$name" '$1 != v' "$SUMS" > "$dir/sums" 2>/dev/null
+                echo "$name $sum" >> "$dir/sums"
+                sort "$dir/sums" > "$SUMS"
+            fi
+        elif [ -z "$expected" ]; then
+            check=unknown
+        elif [ "$sum" = "$expected" ]; then
+            check=ok
+        else
+            check=changed
+        fi
+
+        # The line mandel ends with: compute_us=... write_us=... iterations=...
+        line=$(grep '^mandel: timing' "$dir/log")
+        if [ -z "$line" ]; then
+            echo "bench: $name with $n threads printed no timing" >&2
+            exit 1
+        fi
+
+        # Efficiency compares the compute time to the first thread count's,
+        # scaled by the threads: 1 is perfect scaling.
+        row=$(echo "$line" | awk -v name="$name" -v n="$n" -v pixels=$((size * size)) -v base="$base" -v sum="$sum" -v check="$check" '{
+            for(i=1; i<=NF; i++) {
+                split($i, kv, "=")
+                t[kv[1]] = kv[2]
+            }
+            compute = t["compute_us"] / 1e6
+            write = t["write_us"] / 1e6
+            if(compute <= 0) compute = 1e-6
+            if(base == "") { base = compute * n; first = 1 }
+            printf "%s,%d,%d,%.0f,%.6f,%.6f,%.6f,%.3f,%.3f,%.3f,%s,%s;%.9f\n",
+                name, n, pixels, t["iterations"], compute, write, compute + write,
+                pixels / compute / 1e6, t["iterations"] / compute / 1e9,
+                base / (compute * n), sum, check, first ? compute * n : base
+        }')
+        base=${row##*;}
+        echo "${row%;*}"
+
+        [ "$check" = changed ] && touch "$dir/changed"
+    done
+done || exit 1
+
+if [ -e "$dir/changed" ]; then
+    echo "bench: an image differs from $SUMS" >&2
+    exit 1
+fi
@@ -0,0 +1,195 @@
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Entry files are named by the key's hash, with this suffix.
+#define CACHE_SUFFIX ".tile"
+
+struct cache {
+    char *dir;
+    long long limit;
+    int temp;           // numbers the temporary files of this run
+};
+
+struct cache * cache_open( const char *dir, long long limit )
+{
+    struct cache *c;
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) return 0;
+
+    c = malloc(sizeof(*c));
+    if(!c) return 0;
+
+    c->dir = strdup(dir);
+    c->limit = limit;
+    c->temp = 0;
+    if(!c->dir) {
+        free(c);
+        return 0;
+    }
+
+    return c;
+}
+
+/* 64-bit FNV-1a */
+
+static unsigned long long hash( const void *key, size_t keylen )
+{
+    const unsigned char *p = key;
+    unsigned long long h = 14695981039346656037ULL;
+    size_t i;
+
+    for(i=0; i<keylen; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static void entry_path( struct cache *c, const void *key, size_t keylen, char *path, size_t size )
+{
+    snprintf(path, size, "%s/%016llx" CACHE_SUFFIX, c->dir, hash(key, keylen));
+}
+
+/* An entry is the key's length, the key, then the counts. */
+
+int cache_load( struct cache *c, const void *key, size_t keylen, int *counts, int n )
+{
+    char path[4096];
+    size_t length = sizeof(size_t) + keylen + n*sizeof(int);
+    char *entry = malloc(length);
+    int fd, hit = 0;
+
+    if(!entry) return 0;
+
+    entry_path(c, key, keylen, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if(fd >= 0) {
+        size_t stored;
+        char extra;
+
+        if(read(fd, entry, length) == (ssize_t)length && read(fd, &extra, 1) == 0) {
+            memcpy(&stored, entry, sizeof(size_t));
+            hit = stored == keylen && !memcmp(entry + sizeof(size_t), key, keylen);
+        }
+        close(fd);
+    }
+
+    if(hit) {
+        memcpy(counts, entry + sizeof(size_t) + keylen, n*sizeof(int));
+
+        // Mark it used for the eviction.
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+
+    free(entry);
+    return hit;
+}
+
+void cache_store( struct cache *c, const void *key, size_t keylen, const int *counts, int n )
+{
+    char path[4096], temp[4096];
+    size_t length = sizeof(size_t) + keylen + n*sizeof(int);
+    char *entry = malloc(length);
+    int fd;
+
+    if(!entry) return;
+
+    memcpy(entry, &keylen, sizeof(size_t));
+    memcpy(entry + sizeof(size_t), key, keylen);
+    memcpy(entry + sizeof(size_t) + keylen, counts, n*sizeof(int));
+
+    entry_path(c, key, keylen, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s/.%d.%d", c->dir, (int)getpid(), __sync_fetch_and_add(&c->temp, 1));
+
+    // A failed write only costs a recompute next time.
+    fd = open(temp, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if(fd >= 0) {
+        int ok = write(fd, entry, length) == (ssize_t)length;
+
+        if(close(fd) != 0) ok = 0;
+        if(!ok || rename(temp, path) != 0) unlink(temp);
+    }
+
+    free(entry);
+}
+
+struct entry {
+    char *name;
+    long long used;     // last modified, in nanoseconds
+    long long size;
+};
+
+static int by_use( const void *a, const void *b )
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+/* Remove the least recently used entries until the cache fits its limit. */
+
+static void evict( struct cache *c )
+{
+    DIR *dir = opendir(c->dir);
+    struct dirent *d;
+    struct entry *entries = 0;
+    int count = 0, capacity = 0, i;
+    long long total = 0;
+    char path[4096];
+
+    if(!dir) return;
+
+    while((d = readdir(dir))) {
+        size_t len = strlen(d->d_name);
+        struct stat st;
+
+        if(len <= strlen(CACHE_SUFFIX) || strcmp(d->d_name + len - strlen(CACHE_SUFFIX), CACHE_SUFFIX)) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", c->dir, d->d_name);
+        if(stat(path, &st) != 0) continue;
+
+        if(count == capacity) {
+            struct entry *grown;
+
+            capacity = capacity ? 2*capacity : 256;
+            grown = realloc(entries, capacity * sizeof(*entries));
+            if(!grown) break;
+            entries = grown;
+        }
+        entries[count].name = strdup(d->d_name);
+        entries[count].used = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if(total > c->limit) {
+        qsort(entries, count, sizeof(*entries), by_use);
+
+        for(i=0; i<count && total>c->limit; i++) {
+            snprintf(path, sizeof(path), "%s/%s", c->dir, entries[i].name);
+            if(unlink(path) == 0) total -= entries[i].size;
+        }
+    }
+
+    for(i=0; i<count; i++) free(entries[i].name);
+    free(entries);
+}
+
+void cache_close( struct cache *c )
+{
+    evict(c);
+    free(c->dir);
+    free(c);
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/*
+An on-disk cache of the iteration counts of tiles, shared by every run
+that uses the same directory. Entries are addressed by their content: the
+key is everything the counts depend on, hashed to a file name, and stored
+in the entry too so a hash collision is a miss rather than a wrong tile.
+
+Entries are written to a temporary file and renamed into place, so runs
+can share a directory. A hit marks its entry as used; cache_close then
+removes the least recently used entries until the directory is back
+under its size limit.
+*/
+
+struct cache;
+
+/* Returns 0 if the directory can't be made. */
+struct cache * cache_open( const char *dir, long long limit );
+
+/* Fill counts[0..n-1] from the entry for key; returns 0 on a miss. */
+int            cache_load( struct cache *c, const void *key, size_t keylen, int *counts, int n );
+void           cache_store( struct cache *c, const void *key, size_t keylen, const int *counts, int n );
+
+void           cache_close( struct cache *c );
+
+#endif
@@ -0,0 +1,205 @@
+#include "deep.h"
+
+#include <gmp.h>
+#include <math.h>
+#include <stdlib.h>
+
+/*
+With Z the reference orbit and z = Z + d a pixel's orbit, z*z + c becomes
+
+    d' = (2Z + d)*d + dc
+
+where dc is the pixel's offset from the reference point. Only d and dc are
+kept per pixel, and both stay small until the pixel's orbit wanders away.
+
+A pixel is rebased when its orbit comes closer to zero than to the
+reference orbit (|z| < |d|), or when the reference runs out because it
+escaped: d becomes the whole of z and the pixel follows the reference again
+from Z[0] = 0. This keeps d from growing larger than z, which is when a
+perturbed orbit starts to lose its precision ("glitches"), so one reference
+is enough for the whole image.
+
+Pixels also start "skip" iterations in. For the first iterations every d
+is close to a cubic in dc, d = A*dc + B*dc^2 + C*dc^3, whose coefficients
+follow the reference orbit. The series is used for as long as its cubic
+term is negligible for the farthest pixel.
+*/
+
+// How small the cubic term of the series has to stay next to the linear one.
+#define SERIES_TOLERANCE 1e-9
+
+// The reference orbit Z[0..length], rounded to doubles.
+static double *zx;
+static double *zy;
+static int length;
+
+// The series coefficients after "skip" iterations.
+static int skip;
+static double ax, ay, bx, by, cx, cy;
+
+static void series( double radius )
+{
+    double pax = 0, pay = 0, pbx = 0, pby = 0, pcx = 0, pcy = 0;
+    int n;
+
+    skip = 0;
+    ax = ay = bx = by = cx = cy = 0;
+
+    for(n=0; n+1<length; n++) {
+        double tx = 2*zx[n];
+        double ty = 2*zy[n];
+
+        // A' = 2ZA + 1, B' = 2ZB + A^2, C' = 2ZC + 2AB
+        double nax = tx*pax - ty*pay + 1;
+        double nay = tx*pay + ty*pax;
+        double nbx = tx*pbx - ty*pby + (pax*pax - pay*pay);
+        double nby = tx*pby + ty*pbx + 2*pax*pay;
+        double ncx = tx*pcx - ty*pcy + 2*(pax*pbx - pay*pby);
+        double ncy = tx*pcy + ty*pcx + 2*(pax*pby + pay*pbx);
+
+        double linear = hypot(nax, nay) * radius;
+        double cubic = hypot(ncx, ncy) * radius*radius*radius;
+
+        if(!(cubic <= SERIES_TOLERANCE*linear)) break;
+
+        pax = nax; pay = nay;
+        pbx = nbx; pby = nby;
+        pcx = ncx; pcy = ncy;
+
+        skip = n+1;
+        ax = pax; ay = pay;
+        bx = pbx; by = pby;
+        cx = pcx; cy = pcy;
+    }
+}
+
+int deep_reference( const char *x, const char *y, double radius, int max )
+{
+    mpf_t rx, ry, px, py, xx, yy, xy;
+    long bits;
+    int n;
+
+    // Enough bits to tell the pixels apart, and 64 more for the orbit to use up.
+    bits = 64;
+    if(radius > 0 && radius < 1) bits += (long)ceil(-log2(radius));
+
+    mpf_set_default_prec(bits);
+    mpf_inits(rx, ry, px, py, xx, yy, xy, NULL);
+
+    deep_release();
+    zx = malloc((max+2) * sizeof(double));
+    zy = malloc((max+2) * sizeof(double));
+
+    if(!zx || !zy || mpf_set_str(rx, x, 10) || mpf_set_str(ry, y, 10)) {
+        mpf_clears(rx, ry, px, py, xx, yy, xy, NULL);
+        deep_release();
+        return 0;
+    }
+
+    // Z starts at 0 and runs until it escapes or reaches max.
+    for(n=0; ; n++) {
+        zx[n] = mpf_get_d(px);
+        zy[n] = mpf_get_d(py);
+
+        if(n == max || zx[n]*zx[n] + zy[n]*zy[n] > 4) break;
+
+        mpf_mul(xx, px, px);
+        mpf_mul(yy, py, py);
+        mpf_mul(xy, px, py);
+
+        mpf_sub(px, xx, yy);
+        mpf_add(px, px, rx);
+        mpf_mul_2exp(py, xy, 1);
+        mpf_add(py, py, ry);
+    }
+    length = n;
+
+    mpf_clears(rx, ry, px, py, xx, yy, xy, NULL);
+
+    series(radius);
+
+    return 1;
+}
+
+void deep_release( void )
+{
+    free(zx);
+    free(zy);
+    zx = zy = 0;
+    length = skip = 0;
+}
+
+int deep_orbit_length( void )
+{
+    return length;
+}
+
+int deep_series_skip( void )
+{
+    return skip;
+}
+
+/*
+Iteration count at offset dcx,dcy from the reference point, counted the
+same way as escape_time: z[n] is tested for n from 1 to max, and the first
+one past the bound gives n-1.
+*/
+
+static int deep_escape_time( double dcx, double dcy, int max )
+{
+    double dx, dy, x, y;
+    int n = 0;
+    int m = 0;
+
+    if(skip > 0 && skip <= max) {
+        double c2x = dcx*dcx - dcy*dcy;
+        double c2y = 2*dcx*dcy;
+        double c3x = c2x*dcx - c2y*dcy;
+        double c3y = c2x*dcy + c2y*dcx;
+
+        dx = (ax*dcx - ay*dcy) + (bx*c2x - by*c2y) + (cx*c3x - cy*c3y);
+        dy = (ax*dcy + ay*dcx) + (bx*c2y + by*c2x) + (cx*c3y + cy*c3x);
+        n = m = skip;
+
+        x = zx[m] + dx;
+        y = zy[m] + dy;
+        if(x*x + y*y > 4) return n-1;
+    } else {
+        dx = dy = 0;
+    }
+
+    while(n < max) {
+        double tx = 2*zx[m] + dx;
+        double ty = 2*zy[m] + dy;
+        double nx = tx*dx - ty*dy + dcx;
+        double ny = tx*dy + ty*dx + dcy;
+
+        dx = nx;
+        dy = ny;
+        m++;
+        n++;
+
+        x = zx[m] + dx;
+        y = zy[m] + dy;
+
+        double r = x*x + y*y;
+        if(r > 4) return n-1;
+
+        if(r < dx*dx + dy*dy || m == length) {
+            dx = x;
+            dy = y;
+            m = 0;
+        }
+    }
+
+    return max;
+}
+
+void deep_kernel( const double *dxs, const double *dys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = deep_escape_time(dxs[i], dys[i], max);
+    }
+}
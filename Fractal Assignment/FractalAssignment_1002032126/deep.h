@@ -0,0 +1,28 @@
+#ifndef DEEP_H
+#define DEEP_H
+
+/*
+Deep zoom by perturbation.
+
+Past a scale of about 1e-13 neighbouring pixels have the same coordinates
+in double precision. Instead, one reference orbit is computed at the image
+center in as many bits as the zoom needs, and every pixel iterates only its
+small difference from that orbit, which doubles hold fine.
+
+deep_reference computes the orbit for the center x,y, given as decimal
+strings so they can carry more digits than a double, for pixels up to
+"radius" away from it. deep_kernel then has the escape_kernel signature,
+but takes each point as its offset from the center.
+*/
+
+/* Returns 0 if x or y is not a number or memory runs out. */
+int  deep_reference( const char *x, const char *y, double radius, int max );
+void deep_release( void );
+
+void deep_kernel( const double *dxs, const double *dys, int count, int max, int *iters );
+
+/* Length of the reference orbit, and how many iterations the series skips. */
+int  deep_orbit_length( void );
+int  deep_series_skip( void );
+
+#endif
@@ -0,0 +1,212 @@
+#include "frames.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+enum format { FORMAT_BMP, FORMAT_PPM, FORMAT_Y4M };
+
+struct writer {
+    enum format format;
+    const char *path;
+    FILE *stream;               // for ppm and y4m
+    int width;
+    int height;
+    int fps;
+    unsigned char *line;        // one row of encoded output
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // signalled when a frame is handed over or finished
+    struct bitmap *pending;     // the frame being written, or 0
+    int frame;
+    int closing;
+    int failed;
+};
+
+/* Bitmaps keep the bottom row first, as BMP does; the streams want the top one first. */
+
+static int write_ppm( struct writer *w, struct bitmap *bm )
+{
+    int i,j;
+    int *data = bitmap_data(bm);
+
+    if(fprintf(w->stream, "P6\n%d %d\n255\n", w->width, w->height) < 0) return 0;
+
+    for(j=w->height-1; j>=0; j--) {
+        int *row = data + (long)j*w->width;
+        unsigned char *s = w->line;
+
+        for(i=0; i<w->width; i++) {
+            *s++ = GET_RED(row[i]);
+            *s++ = GET_GREEN(row[i]);
+            *s++ = GET_BLUE(row[i]);
+        }
+        if(fwrite(w->line, 3, w->width, w->stream) != (size_t)w->width) return 0;
+    }
+
+    return 1;
+}
+
+/*
+Y4M in 4:4:4, full range BT.601: the Y, then U, then V plane of the frame,
+in 16.16 fixed point.
+*/
+
+static int write_y4m( struct writer *w, struct bitmap *bm )
+{
+    int i,j,plane;
+    int *data = bitmap_data(bm);
+
+    if(fputs("FRAME\n", w->stream) < 0) return 0;
+
+    for(plane=0; plane<3; plane++) {
+        for(j=w->height-1; j>=0; j--) {
+            int *row = data + (long)j*w->width;
+
+            for(i=0; i<w->width; i++) {
+                int r = GET_RED(row[i]);
+                int g = GET_GREEN(row[i]);
+                int b = GET_BLUE(row[i]);
+                int v;
+
+                if(plane == 0)      v = (19595*r + 38470*g + 7471*b + 32768) >> 16;
+                else if(plane == 1) v = ((-11059*r - 21709*g + 32768*b + 32768) >> 16) + 128;
+                else                v = ((32768*r - 27439*g - 5329*b + 32768) >> 16) + 128;
+
+                w->line[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+            }
+            if(fwrite(w->line, 1, w->width, w->stream) != (size_t)w->width) return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int write_frame( struct writer *w, struct bitmap *bm, int frame )
+{
+    char name[4096];
+
+    switch(w->format) {
+        case FORMAT_BMP:
+            snprintf(name, sizeof(name), w->path, frame);
+            return bitmap_save(bm, name);
+        case FORMAT_PPM:
+            return write_ppm(w, bm);
+        case FORMAT_Y4M:
+            return write_y4m(w, bm);
+    }
+
+    return 0;
+}
+
+static void* writer_thread( void *arg )
+{
+    struct writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;) {
+        while(!w->pending && !w->closing) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if(!w->pending) break;
+
+        struct bitmap *bm = w->pending;
+        int frame = w->frame;
+        pthread_mutex_unlock(&w->lock);
+
+        int ok = write_frame(w, bm, frame);
+
+        pthread_mutex_lock(&w->lock);
+        if(!ok) w->failed = 1;
+        w->pending = 0;
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+struct writer * writer_create( const char *format, const char *path, int width, int height, int fps )
+{
+    struct writer *w = calloc(1, sizeof(*w));
+    if(!w) return 0;
+
+    if(!strcmp(format, "bmp"))      w->format = FORMAT_BMP;
+    else if(!strcmp(format, "ppm")) w->format = FORMAT_PPM;
+    else if(!strcmp(format, "y4m")) w->format = FORMAT_Y4M;
+    else {
+        free(w);
+        return 0;
+    }
+
+    w->path = path;
+    w->width = width;
+    w->height = height;
+    w->fps = fps;
+    w->line = malloc(width * 3);
+
+    if(w->format != FORMAT_BMP) {
+        w->stream = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+    }
+    if(!w->line || (w->format != FORMAT_BMP && !w->stream)) {
+        free(w->line);
+        free(w);
+        return 0;
+    }
+
+    if(w->format == FORMAT_Y4M) {
+        fprintf(w->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 XCOLORRANGE=FULL\n", width, height, fps);
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+    pthread_create(&w->thread, NULL, writer_thread, w);
+
+    return w;
+}
+
+int writer_submit( struct writer *w, struct bitmap *bm, int frame )
+{
+    int ok;
+
+    pthread_mutex_lock(&w->lock);
+    while(w->pending) {
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+    ok = !w->failed;
+    if(ok) {
+        w->pending = bm;
+        w->frame = frame;
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return ok;
+}
+
+int writer_finish( struct writer *w )
+{
+    int ok;
+
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    ok = !w->failed;
+    if(w->stream) {
+        if(fflush(w->stream) != 0) ok = 0;
+        if(w->stream != stdout && fclose(w->stream) != 0) ok = 0;
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    free(w->line);
+    free(w);
+
+    return ok;
+}
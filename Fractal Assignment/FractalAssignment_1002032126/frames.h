@@ -0,0 +1,31 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "bitmap.h"
+
+/*
+Frame output for animations. A writer has its own thread, which encodes and
+writes one frame while the caller renders the next.
+
+"bmp" writes each frame to its own file, named by the printf pattern "path"
+with the frame number (e.g. frame%04d.bmp). "ppm" and "y4m" write all the
+frames as one stream to "path", or to standard output if path is "-", ready
+to be piped into an encoder.
+*/
+
+struct writer;
+
+/* Returns 0 for an unknown format or an output that can't be opened. */
+struct writer * writer_create( const char *format, const char *path, int width, int height, int fps );
+
+/*
+Hand frame number "frame" to the writer. This first waits until the frame
+before it has been written, so once it returns the bitmap that frame was
+in can be rendered into again. Returns 0 if a write has failed.
+*/
+int             writer_submit( struct writer *w, struct bitmap *bm, int frame );
+
+/* Write the last frame and close. Returns 0 if any write failed. */
+int             writer_finish( struct writer *w );
+
+#endif
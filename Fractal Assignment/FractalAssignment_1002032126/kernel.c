@@ -0,0 +1,488 @@
+#include "kernel.h"
+
+#include <string.h>
+#include <immintrin.h>
+
+/*
+The vector kernels run the same operations in the same order as
+escape_time, one pixel per lane, so their counts are bit-identical as long
+as nothing fuses a multiply and an add. The Makefile builds this file with
+-ffp-contract=off to make sure of that.
+*/
+
+/*
+True if x,y lies in the main cardioid or in the period-2 bulb to its left.
+Those points never escape, so there is no need to iterate them.
+*/
+
+static int in_main_bulbs( double x, double y )
+{
+    double xq = x - 0.25;
+    double q = xq*xq + y*y;
+
+    if(q*(q + xq) <= 0.25*y*y) return 1;
+    if((x+1)*(x+1) + y*y <= 0.0625) return 1;
+
+    return 0;
+}
+
+/*
+Besides the bulb test, the loop watches for the orbit landing exactly on a
+point it visited before (Brent's method: remember one point, and move it
+forward every time the distance checked doubles). From there the orbit
+repeats points that have already passed the bound, so the full loop would
+run to max, and returning max now gives the same answer.
+*/
+
+int escape_time( double x, double y, int max )
+{
+    double x0 = x;
+    double y0 = y;
+
+    double sx = x;
+    double sy = y;
+    int period = 0;
+    int limit = 2;
+
+    int iter = 0;
+
+    if(in_main_bulbs(x, y)) return max;
+
+    while( (x*x + y*y <= 4) && iter < max ) {
+        double xt = x*x - y*y + x0;
+        double yt = 2*x*y + y0;
+
+        x = xt;
+        y = yt;
+
+        iter++;
+
+        if(x == sx && y == sy) return max;
+        if(++period == limit) {
+            sx = x;
+            sy = y;
+            period = 0;
+            limit *= 2;
+        }
+    }
+
+    return iter;
+}
+
+static void kernel_scalar( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = escape_time(xs[i], ys[i], max);
+    }
+}
+
+/*
+Four pixels at a time. A lane drops out of "active" the first time its point
+escapes and its count stops there; the loop ends when no lane is active.
+Lanes in the bulbs or caught in a cycle drop out with their count at max,
+the same shortcuts escape_time takes.
+*/
+
+__attribute__((target("avx2")))
+static void kernel_avx2( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d quarter = _mm256_set1_pd(0.25);
+    const __m256d sixteenth = _mm256_set1_pd(0.0625);
+    const __m256d top = _mm256_set1_pd(max);
+    int i, k;
+
+    for(i=0; i+4<=count; i+=4) {
+        __m256d x0 = _mm256_loadu_pd(xs+i);
+        __m256d y0 = _mm256_loadu_pd(ys+i);
+        __m256d y2 = _mm256_mul_pd(y0, y0);
+        __m256d zx = x0;
+        __m256d zy = y0;
+        __m256d sx = zx;
+        __m256d sy = zy;
+        int period = 0;
+        int limit = 2;
+
+        // Same bulb test as in_main_bulbs, lane by lane
+        __m256d xq = _mm256_sub_pd(x0, quarter);
+        __m256d q = _mm256_add_pd(_mm256_mul_pd(xq, xq), y2);
+        __m256d cardioid = _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xq)),
+                                         _mm256_mul_pd(_mm256_mul_pd(quarter, y0), y0), _CMP_LE_OQ);
+        __m256d x1 = _mm256_add_pd(x0, one);
+        __m256d bulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(x1, x1), y2), sixteenth, _CMP_LE_OQ);
+        __m256d inside = _mm256_or_pd(cardioid, bulb);
+
+        __m256d n = _mm256_and_pd(inside, top);
+        __m256d active = _mm256_andnot_pd(inside, _mm256_cmp_pd(zx, zx, _CMP_EQ_OQ));
+
+        for(k=0; k<max; k++) {
+            __m256d xx = _mm256_mul_pd(zx, zx);
+            __m256d yy = _mm256_mul_pd(zy, zy);
+            __m256d in = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(xx, yy), four, _CMP_LE_OQ));
+
+            if(_mm256_movemask_pd(in) == 0) break;
+
+            n = _mm256_add_pd(n, _mm256_and_pd(in, one));
+            active = in;
+
+            __m256d xt = _mm256_add_pd(_mm256_sub_pd(xx, yy), x0);
+            zy = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zx), zy), y0);
+            zx = xt;
+
+            __m256d cycle = _mm256_and_pd(active, _mm256_and_pd(_mm256_cmp_pd(zx, sx, _CMP_EQ_OQ),
+                                                               _mm256_cmp_pd(zy, sy, _CMP_EQ_OQ)));
+            if(_mm256_movemask_pd(cycle)) {
+                n = _mm256_blendv_pd(n, top, cycle);
+                active = _mm256_andnot_pd(cycle, active);
+            }
+            if(++period == limit) {
+                sx = zx;
+                sy = zy;
+                period = 0;
+                limit *= 2;
+            }
+        }
+
+        _mm_storeu_si128((__m128i*)(iters+i), _mm256_cvtpd_epi32(n));
+    }
+
+    kernel_scalar(xs+i, ys+i, count-i, max, iters+i);
+}
+
+/* Eight pixels at a time, with the active lanes held in a mask register. */
+
+__attribute__((target("avx512f")))
+static void kernel_avx512( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d quarter = _mm512_set1_pd(0.25);
+    const __m512d sixteenth = _mm512_set1_pd(0.0625);
+    const __m512d top = _mm512_set1_pd(max);
+    int i, k;
+
+    for(i=0; i+8<=count; i+=8) {
+        __m512d x0 = _mm512_loadu_pd(xs+i);
+        __m512d y0 = _mm512_loadu_pd(ys+i);
+        __m512d y2 = _mm512_mul_pd(y0, y0);
+        __m512d zx = x0;
+        __m512d zy = y0;
+        __m512d sx = zx;
+        __m512d sy = zy;
+        int period = 0;
+        int limit = 2;
+
+        __m512d xq = _mm512_sub_pd(x0, quarter);
+        __m512d q = _mm512_add_pd(_mm512_mul_pd(xq, xq), y2);
+        __mmask8 cardioid = _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, xq)),
+                                               _mm512_mul_pd(_mm512_mul_pd(quarter, y0), y0), _CMP_LE_OQ);
+        __m512d x1 = _mm512_add_pd(x0, one);
+        __mmask8 bulb = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(x1, x1), y2), sixteenth, _CMP_LE_OQ);
+        __mmask8 inside = cardioid | bulb;
+
+        __m512d n = _mm512_maskz_mov_pd(inside, top);
+        __mmask8 active = ~inside;
+
+        for(k=0; k<max; k++) {
+            __m512d xx = _mm512_mul_pd(zx, zx);
+            __m512d yy = _mm512_mul_pd(zy, zy);
+
+            active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(xx, yy), four, _CMP_LE_OQ);
+            if(active == 0) break;
+
+            n = _mm512_mask_add_pd(n, active, n, one);
+
+            __m512d xt = _mm512_add_pd(_mm512_sub_pd(xx, yy), x0);
+            zy = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zx), zy), y0);
+            zx = xt;
+
+            __mmask8 cycle = _mm512_mask_cmp_pd_mask(active, zx, sx, _CMP_EQ_OQ) &
+                             _mm512_cmp_pd_mask(zy, sy, _CMP_EQ_OQ);
+            if(cycle) {
+                n = _mm512_mask_mov_pd(n, cycle, top);
+                active &= ~cycle;
+            }
+            if(++period == limit) {
+                sx = zx;
+                sy = zy;
+                period = 0;
+                limit *= 2;
+            }
+        }
+
+        _mm256_storeu_si256((__m256i*)(iters+i), _mm512_cvtpd_epi32(n));
+    }
+
+    kernel_avx2(xs+i, ys+i, count-i, max, iters+i);
+}
+
+/*
+Single precision. The same loops in float, with the points rounded to
+float on the way in: half the work per point, twice the lanes per vector.
+Good only while the pixels are far apart next to float's epsilon; the float
+kernels agree with each other exactly, not with the double ones. Their
+counts are kept as integers, which floats would not hold past 2^24.
+*/
+
+static int in_main_bulbs_float( float x, float y )
+{
+    float xq = x - 0.25f;
+    float q = xq*xq + y*y;
+
+    if(q*(q + xq) <= 0.25f*y*y) return 1;
+    if((x+1)*(x+1) + y*y <= 0.0625f) return 1;
+
+    return 0;
+}
+
+int escape_time_float( float x, float y, int max )
+{
+    float x0 = x;
+    float y0 = y;
+
+    float sx = x;
+    float sy = y;
+    int period = 0;
+    int limit = 2;
+
+    int iter = 0;
+
+    if(in_main_bulbs_float(x, y)) return max;
+
+    while( (x*x + y*y <= 4) && iter < max ) {
+        float xt = x*x - y*y + x0;
+        float yt = 2*x*y + y0;
+
+        x = xt;
+        y = yt;
+
+        iter++;
+
+        if(x == sx && y == sy) return max;
+        if(++period == limit) {
+            sx = x;
+            sy = y;
+            period = 0;
+            limit *= 2;
+        }
+    }
+
+    return iter;
+}
+
+static void kernel_scalar_float( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = escape_time_float((float)xs[i], (float)ys[i], max);
+    }
+}
+
+/* Eight pixels at a time. */
+
+__attribute__((target("avx2")))
+static void kernel_avx2_float( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    const __m256 sixteenth = _mm256_set1_ps(0.0625f);
+    const __m256i top = _mm256_set1_epi32(max);
+    int i, k;
+
+    for(i=0; i+8<=count; i+=8) {
+        __m256 x0 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(xs+i+4)), _mm256_cvtpd_ps(_mm256_loadu_pd(xs+i)));
+        __m256 y0 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(ys+i+4)), _mm256_cvtpd_ps(_mm256_loadu_pd(ys+i)));
+        __m256 y2 = _mm256_mul_ps(y0, y0);
+        __m256 zx = x0;
+        __m256 zy = y0;
+        __m256 sx = zx;
+        __m256 sy = zy;
+        int period = 0;
+        int limit = 2;
+
+        __m256 xq = _mm256_sub_ps(x0, quarter);
+        __m256 q = _mm256_add_ps(_mm256_mul_ps(xq, xq), y2);
+        __m256 cardioid = _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xq)),
+                                        _mm256_mul_ps(_mm256_mul_ps(quarter, y0), y0), _CMP_LE_OQ);
+        __m256 x1 = _mm256_add_ps(x0, one);
+        __m256 bulb = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(x1, x1), y2), sixteenth, _CMP_LE_OQ);
+        __m256 inside = _mm256_or_ps(cardioid, bulb);
+
+        __m256i n = _mm256_and_si256(_mm256_castps_si256(inside), top);
+        __m256 active = _mm256_andnot_ps(inside, _mm256_cmp_ps(zx, zx, _CMP_EQ_OQ));
+
+        for(k=0; k<max; k++) {
+            __m256 xx = _mm256_mul_ps(zx, zx);
+            __m256 yy = _mm256_mul_ps(zy, zy);
+            __m256 in = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(xx, yy), four, _CMP_LE_OQ));
+
+            if(_mm256_movemask_ps(in) == 0) break;
+
+            // A true lane is all ones, -1 as an integer
+            n = _mm256_sub_epi32(n, _mm256_castps_si256(in));
+            active = in;
+
+            __m256 xt = _mm256_add_ps(_mm256_sub_ps(xx, yy), x0);
+            zy = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two, zx), zy), y0);
+            zx = xt;
+
+            __m256 cycle = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(zx, sx, _CMP_EQ_OQ),
+                                                               _mm256_cmp_ps(zy, sy, _CMP_EQ_OQ)));
+            if(_mm256_movemask_ps(cycle)) {
+                n = _mm256_blendv_epi8(n, top, _mm256_castps_si256(cycle));
+                active = _mm256_andnot_ps(cycle, active);
+            }
+            if(++period == limit) {
+                sx = zx;
+                sy = zy;
+                period = 0;
+                limit *= 2;
+            }
+        }
+
+        _mm256_storeu_si256((__m256i*)(iters+i), n);
+    }
+
+    kernel_scalar_float(xs+i, ys+i, count-i, max, iters+i);
+}
+
+/* Sixteen pixels at a time. */
+
+__attribute__((target("avx512f")))
+static __m512 load_float16( const double *p )
+{
+    __m512d lo = _mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(_mm512_loadu_pd(p))));
+    __m256d hi = _mm256_castps_pd(_mm512_cvtpd_ps(_mm512_loadu_pd(p+8)));
+    return _mm512_castpd_ps(_mm512_insertf64x4(lo, hi, 1));
+}
+
+__attribute__((target("avx512f")))
+static void kernel_avx512_float( const double *xs, const double *ys, int count, int max, int *iters )
+{
+    const __m512 four = _mm512_set1_ps(4.0f);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 quarter = _mm512_set1_ps(0.25f);
+    const __m512 sixteenth = _mm512_set1_ps(0.0625f);
+    const __m512i top = _mm512_set1_epi32(max);
+    const __m512i step = _mm512_set1_epi32(1);
+    int i, k;
+
+    for(i=0; i+16<=count; i+=16) {
+        __m512 x0 = load_float16(xs+i);
+        __m512 y0 = load_float16(ys+i);
+        __m512 y2 = _mm512_mul_ps(y0, y0);
+        __m512 zx = x0;
+        __m512 zy = y0;
+        __m512 sx = zx;
+        __m512 sy = zy;
+        int period = 0;
+        int limit = 2;
+
+        __m512 xq = _mm512_sub_ps(x0, quarter);
+        __m512 q = _mm512_add_ps(_mm512_mul_ps(xq, xq), y2);
+        __mmask16 cardioid = _mm512_cmp_ps_mask(_mm512_mul_ps(q, _mm512_add_ps(q, xq)),
+                                                _mm512_mul_ps(_mm512_mul_ps(quarter, y0), y0), _CMP_LE_OQ);
+        __m512 x1 = _mm512_add_ps(x0, one);
+        __mmask16 bulb = _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(x1, x1), y2), sixteenth, _CMP_LE_OQ);
+        __mmask16 inside = cardioid | bulb;
+
+        __m512i n = _mm512_maskz_mov_epi32(inside, top);
+        __mmask16 active = ~inside;
+
+        for(k=0; k<max; k++) {
+            __m512 xx = _mm512_mul_ps(zx, zx);
+            __m512 yy = _mm512_mul_ps(zy, zy);
+
+            active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(xx, yy), four, _CMP_LE_OQ);
+            if(active == 0) break;
+
+            n = _mm512_mask_add_epi32(n, active, n, step);
+
+            __m512 xt = _mm512_add_ps(_mm512_sub_ps(xx, yy), x0);
+            zy = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(two, zx), zy), y0);
+            zx = xt;
+
+            __mmask16 cycle = _mm512_mask_cmp_ps_mask(active, zx, sx, _CMP_EQ_OQ) &
+                              _mm512_cmp_ps_mask(zy, sy, _CMP_EQ_OQ);
+            if(cycle) {
+                n = _mm512_mask_mov_epi32(n, cycle, top);
+                active &= ~cycle;
+            }
+            if(++period == limit) {
+                sx = zx;
+                sy = zy;
+                period = 0;
+                limit *= 2;
+            }
+        }
+
+        _mm512_storeu_si512((void*)(iters+i), n);
+    }
+
+    kernel_avx2_float(xs+i, ys+i, count-i, max, iters+i);
+}
+
+struct kernel_entry {
+    const char *name;
+    const char *isa;        // what __builtin_cpu_supports must report, or 0
+    escape_kernel kernel;
+    int single;             // works in float
+};
+
+// Widest first, so "auto" takes the first one the CPU supports
+static const struct kernel_entry kernels[] = {
+    { "avx512", "avx512f", kernel_avx512,       0 },
+    { "avx2",   "avx2",    kernel_avx2,         0 },
+    { "scalar", 0,         kernel_scalar,       0 },
+    { "avx512", "avx512f", kernel_avx512_float, 1 },
+    { "avx2",   "avx2",    kernel_avx2_float,   1 },
+    { "scalar", 0,         kernel_scalar_float, 1 },
+};
+
+#define KERNEL_COUNT ((int)(sizeof(kernels)/sizeof(kernels[0])))
+
+static int supported( const struct kernel_entry *k )
+{
+    if(!k->isa) return 1;
+
+    __builtin_cpu_init();
+    if(!strcmp(k->isa, "avx512f")) return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+    if(!strcmp(k->isa, "avx2")) return __builtin_cpu_supports("avx2");
+    return 0;
+}
+
+escape_kernel kernel_select( const char *name, int single )
+{
+    int i;
+
+    for(i=0; i<KERNEL_COUNT; i++) {
+        if(kernels[i].single != single) continue;
+
+        if(!strcmp(name, "auto") || !strcmp(name, kernels[i].name)) {
+            if(supported(&kernels[i])) return kernels[i].kernel;
+            if(strcmp(name, "auto")) return 0;
+        }
+    }
+
+    return 0;
+}
+
+const char *kernel_name( escape_kernel kernel )
+{
+    int i;
+
+    for(i=0; i<KERNEL_COUNT; i++) {
+        if(kernels[i].kernel == kernel) return kernels[i].name;
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,31 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+/*
+Escape-time kernels. A kernel computes the iteration count at the "count"
+points xs[i],ys[i] and stores them in iters[]. Every double kernel returns
+exactly the counts escape_time would, and every float kernel the counts
+escape_time_float would.
+*/
+
+/*
+Raised whenever a change to any kernel changes any count, so that counts
+saved by an older build (see cache.h) are not taken for new ones.
+*/
+#define KERNEL_VERSION 1
+
+typedef void (*escape_kernel)( const double *xs, const double *ys, int count, int max, int *iters );
+
+/* Number of iterations at point x,y in the Mandelbrot space, up to max. */
+int escape_time( double x, double y, int max );
+int escape_time_float( float x, float y, int max );
+
+/*
+Look up a kernel by name: "scalar", "avx2", "avx512", or "auto" for the
+widest one this CPU supports, in double or, if "single" is set, in float.
+Returns 0 for an unknown name or a kernel the CPU cannot run.
+*/
+escape_kernel kernel_select( const char *name, int single );
+const char   *kernel_name( escape_kernel kernel );
+
+#endif
@@ -1,4 +1,12 @@
 #include "bitmap.h"
+#include "pool.h"
+#include "kernel.h"
+#include "deep.h"
+#include "precise.h"
+#include "frames.h"
+#include "pyramid.h"
+#include "cache.h"
+#include "palette.h"
 
 #include <getopt.h>
 #include <stdlib.h>
@@ -7,6 +15,21 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+
+// Width and height in pixels of the tiles handed to the thread pool.
+#define TILE_SIZE 32
+
+// A number type resolves the image while pixels are at least this many of
+// its epsilons apart. The slack covers |z| up to 2 and the rounding errors
+// the iteration builds up.
+#define TIER_MARGIN 4096
+
+// Rows in each band bitmap_save_parallel hands to a thread.
+#define SAVE_ROWS 64
+
+// Grid spacing of the first progressive pass. TILE_SIZE must be a multiple of it.
+#define PROGRESSIVE_STEP 4
 
 struct mandel_args{
     struct bitmap *bm;
@@ -14,51 +37,917 @@ struct mandel_args{
     double xmax;
     double ymin;
     double ymax;
-    double max;
-    int hmin;
-    int hmax;
+    int max;
+    escape_kernel kernel;
+    escape_kernel reference;    // double kernel to check the float one against, or 0
+    long checked;               // points checked, and how many of them differed
+    long differ;
+    long iterations;            // sum of the counts computed
+    int trace;          // render by border tracing
+    int step;           // grid spacing of the progressive pass, 0 if not progressive
+    int rows;           // rows to compute, the rest are mirrored from them
+    int tiles_across;
+    int tiles_down;
+    struct bitmap_stream *stream;   // where finished bands of tiles go, or 0
+    int *tiles_done;                // finished tiles in each band
+    struct cache *cache;            // where tiles' counts are kept between runs, or 0
+    char view[256];                 // what the counts depend on besides the points
+    long cache_hits;
+    long cache_tiles;
+    const int *palette;             // color of each count, 0..max
+    int *counts;                    // the raw counts of the rows computed, to color later, or 0
 };
 
+/*
+The number types the iteration can run in, cheapest first. The automatic
+choice is the first one from double up that resolves the image;
+perturbation works at any depth. Float is only used when asked for: its
+rounding error grows with every iteration, and however far apart the
+pixels are, points near the boundary flip between escaping and not.
+*/
+
+enum tier { TIER_FLOAT, TIER_DOUBLE, TIER_DD, TIER_QUAD, TIER_DEEP };
+
+struct tier_entry {
+    const char *name;
+    double epsilon;
+};
+
+static const struct tier_entry tiers[] = {
+    [TIER_FLOAT]  = { "float",  0x1p-23 },
+    [TIER_DOUBLE] = { "double", 0x1p-52 },
+    [TIER_DD]     = { "dd",     0x1p-104 },
+    [TIER_QUAD]   = { "quad",   0x1p-112 },
+    [TIER_DEEP]   = { "deep",   0 },
+};
+
+#define TIER_COUNT ((int)(sizeof(tiers)/sizeof(tiers[0])))
+
 int iteration_to_color( int i, int max );
 int iterations_at_point( double x, double y, int max );
 
 /*
-Compute an entire Mandelbrot image, writing each point to the given bitmap.
-Scale the image to the range (xmin-xmax,ymin-ymax), limiting iterations to "max"
+Real coordinate of column i and imaginary coordinate of row j. Every way of
+rendering goes through these, so they all sample exactly the same points.
+*/
+
+static double column_x( struct mandel_args *mandel_arg, int i )
+{
+    return mandel_arg->xmin + i*(mandel_arg->xmax-mandel_arg->xmin)/bitmap_width(mandel_arg->bm);
+}
+
+/*
+A view centred on the real axis measures its rows from the axis, so that
+row height-j is exactly the negation of row j; ymin + j*dy only gets there
+to within a rounding step.
+*/
+
+static double row_y( struct mandel_args *mandel_arg, int j )
+{
+    int height = bitmap_height(mandel_arg->bm);
+
+    if(mandel_arg->ymin == -mandel_arg->ymax) {
+        return (2*j - height)*mandel_arg->ymax/height;
+    }
+    return mandel_arg->ymin + j*(mandel_arg->ymax-mandel_arg->ymin)/height;
+}
+
+/*
+Set pixel i,j to color.
+
+When the image is symmetric about the real axis only the top "rows" rows are
+computed, and each is also copied to row height-j. That row then holds the
+complex conjugates of row j, exactly the points it would sample itself,
+which have mirrored orbits and the same counts.
+*/
+
+static void store_pixel( struct mandel_args *mandel_arg, int i, int j, int color )
+{
+    int height = bitmap_height(mandel_arg -> bm);
+    int mirror = height - j;
+
+    bitmap_set(mandel_arg->bm,i,j,color);
+    if(mirror >= mandel_arg->rows && mirror < height) {
+        bitmap_set(mandel_arg->bm,i,mirror,color);
+    }
+}
+
+/*
+Color columns x0 to x1-1 of row j from their iteration counts, or when the
+colors depend on the whole image, keep the counts to color it later.
+*/
+
+static void store_row( struct mandel_args *mandel_arg, int x0, int x1, int j, const int *iters )
+{
+    int i;
+
+    if(mandel_arg->counts) {
+        long row = (long)j * bitmap_width(mandel_arg->bm);
+        memcpy(mandel_arg->counts + row + x0, iters, (x1-x0) * sizeof(int));
+        return;
+    }
+
+    for(i=x0; i<x1; i++) {
+        store_pixel(mandel_arg, i, j, mandel_arg->palette[iters[i-x0]]);
+    }
+}
+
+/*
+Run the kernel over n points. When validating, the double kernel runs over
+them too and the points where the two disagree are counted.
+*/
+
+static void run_kernel( struct mandel_args *mandel_arg, const double *xs, const double *ys, int n, int *iters )
+{
+    int k;
+
+    long sum = 0;
+
+    mandel_arg->kernel(xs, ys, n, mandel_arg->max, iters);
+
+    for(k=0; k<n; k++) {
+        sum += iters[k];
+    }
+    __sync_fetch_and_add(&mandel_arg->iterations, sum);
+
+    if(mandel_arg->reference && n > 0) {
+        int check[n];
+        long differ = 0;
+
+        mandel_arg->reference(xs, ys, n, mandel_arg->max, check);
+        for(k=0; k<n; k++) {
+            differ += check[k] != iters[k];
+        }
+
+        __sync_fetch_and_add(&mandel_arg->checked, n);
+        __sync_fetch_and_add(&mandel_arg->differ, differ);
+    }
+}
+
+/*
+Compute the part of a Mandelbrot image in columns x0 to x1-1 and rows y0 to y1-1,
+at most one tile, writing the iteration count of each point to counts. The
+whole image covers the range (xmin-xmax,ymin-ymax), limiting iterations to "max"
+*/
+
+void compute_image( struct mandel_args *mandel_arg, int x0, int y0, int x1, int y1, int counts[][TILE_SIZE] )
+{
+    int i,j;
+
+    double xs[x1-x0];
+    double ys[x1-x0];
+
+    // Determine the x coordinate of every column once, the rows all share them.
+    for(i=x0; i<x1; i++) {
+        xs[i-x0] = column_x(mandel_arg, i);
+    }
+
+    // For every row in the region...
+
+    for(j=y0; j<y1; j++) {
+
+        double y = row_y(mandel_arg, j);
+        for(i=x0; i<x1; i++) {
+            ys[i-x0] = y;
+        }
+
+        // Compute the iterations at every point along the row.
+        run_kernel(mandel_arg, xs, ys, x1-x0, counts[j-y0]);
+
+    }
+}
+
+/*
+Border tracing (Mariani-Silver). The set and every band of equal iteration
+count are connected, so if the whole border of a rectangle has one count the
+inside is assumed to have it too and is filled without being computed.
+Otherwise the rectangle is cut in two across its longer side, the cut line
+being shared by both halves, and each half is checked the same way. Thin
+filaments that cross a rectangle without touching its border are lost,
+which is why this is an option rather than the default.
+
+The counts of one tile are kept in a trace; -1 marks a point not computed yet,
+so the lines shared by neighbouring rectangles are computed only once. The
+missing points of a border are gathered and handed to the kernel together,
+so the vector kernels stay busy on the columns as well as the rows.
 */
 
-void* compute_image(void* arg)
+// Rectangles narrower than this are computed point by point instead of split.
+#define TRACE_MIN 6
+
+struct trace {
+    struct mandel_args *args;
+    double xs[TILE_SIZE];
+    double ys[TILE_SIZE];
+    int counts[TILE_SIZE][TILE_SIZE];
+
+    // Points gathered for the kernel
+    int pending;
+    double px[TILE_SIZE*TILE_SIZE];
+    double py[TILE_SIZE*TILE_SIZE];
+    int *slot[TILE_SIZE*TILE_SIZE];
+    int iters[TILE_SIZE*TILE_SIZE];
+};
+
+static void trace_want( struct trace *t, int i, int j )
+{
+    if(t->counts[j][i] < 0) {
+        t->px[t->pending] = t->xs[i];
+        t->py[t->pending] = t->ys[j];
+        t->slot[t->pending] = &t->counts[j][i];
+        t->counts[j][i] = -2;   // gathered, so a corner is not taken twice
+        t->pending++;
+    }
+}
+
+static void trace_flush( struct trace *t )
+{
+    int k;
+
+    run_kernel(t->args, t->px, t->py, t->pending, t->iters);
+    for(k=0; k<t->pending; k++) {
+        *t->slot[k] = t->iters[k];
+    }
+    t->pending = 0;
+}
+
+// Fill in columns x0 to x1-1 and rows y0 to y1-1 of the trace.
+static void trace_region( struct trace *t, int x0, int y0, int x1, int y1 )
 {
     int i,j;
+
+    for(i=x0; i<x1; i++) {
+        trace_want(t, i, y0);
+        trace_want(t, i, y1-1);
+    }
+    for(j=y0+1; j<y1-1; j++) {
+        trace_want(t, x0, j);
+        trace_want(t, x1-1, j);
+    }
+    trace_flush(t);
+
+    // Nothing but border
+    if(x1-x0 <= 2 || y1-y0 <= 2) return;
+
+    int count = t->counts[y0][x0];
+    int uniform = 1;
+
+    for(i=x0; i<x1 && uniform; i++) {
+        uniform = t->counts[y0][i] == count && t->counts[y1-1][i] == count;
+    }
+    for(j=y0+1; j<y1-1 && uniform; j++) {
+        uniform = t->counts[j][x0] == count && t->counts[j][x1-1] == count;
+    }
+
+    if(uniform) {
+        for(j=y0+1; j<y1-1; j++) {
+            for(i=x0+1; i<x1-1; i++) {
+                t->counts[j][i] = count;
+            }
+        }
+    } else if(x1-x0 < TRACE_MIN || y1-y0 < TRACE_MIN) {
+        for(j=y0+1; j<y1-1; j++) {
+            for(i=x0+1; i<x1-1; i++) {
+                trace_want(t, i, j);
+            }
+        }
+        trace_flush(t);
+    } else if(x1-x0 >= y1-y0) {
+        int mid = (x0 + x1) / 2;
+        trace_region(t, x0, y0, mid+1, y1);
+        trace_region(t, mid, y0, x1, y1);
+    } else {
+        int mid = (y0 + y1) / 2;
+        trace_region(t, x0, y0, x1, mid+1);
+        trace_region(t, x0, mid, x1, y1);
+    }
+}
+
+/* Same as compute_image, for one tile at most, but by border tracing. */
+
+void trace_image( struct mandel_args *mandel_arg, int x0, int y0, int x1, int y1, int counts[][TILE_SIZE] )
+{
+    int i,j;
+    struct trace t;
+
+    t.args = mandel_arg;
+    t.pending = 0;
+    for(i=x0; i<x1; i++) {
+        t.xs[i-x0] = column_x(mandel_arg, i);
+    }
+    for(j=y0; j<y1; j++) {
+        t.ys[j-y0] = row_y(mandel_arg, j);
+    }
+    memset(t.counts, -1, sizeof(t.counts));
+
+    trace_region(&t, 0, 0, x1-x0, y1-y0);
+
+    memcpy(counts, t.counts, sizeof(t.counts));
+}
+
+/*
+Progressive rendering. The image is computed in passes over a grid of every
+"step"th point, PROGRESSIVE_STEP first and halving down to 1. Each point
+colors the whole step by step block below and to the right of it, so the
+early passes give a blocky preview of the final image. A pass skips the
+points coarser passes already computed, and by the end every pixel has been
+colored from its own point, exactly as in a direct render.
+
+This renders one pass over columns x0 to x1-1 and rows y0 to y1-1; x0 and y0
+must be multiples of the step.
+*/
+
+void progressive_image( struct mandel_args *mandel_arg, int x0, int y0, int x1, int y1 )
+{
+    int i,j,k,r,c;
+    int step = mandel_arg->step;
+
+    double xs[x1-x0];
+    double ys[x1-x0];
+    int columns[x1-x0];
+    int iters[x1-x0];
+
+    for(j=y0; j<y1; j+=step) {
+
+        double y = row_y(mandel_arg, j);
+        int n = 0;
+
+        // Gather the points of this row that no earlier pass computed.
+        for(i=x0; i<x1; i+=step) {
+            if(step < PROGRESSIVE_STEP && i%(2*step) == 0 && j%(2*step) == 0) continue;
+
+            xs[n] = column_x(mandel_arg, i);
+            ys[n] = y;
+            columns[n] = i;
+            n++;
+        }
+
+        run_kernel(mandel_arg, xs, ys, n, iters);
+
+        // Color each point's block, clipped to the region.
+        for(k=0; k<n; k++) {
+            int color = mandel_arg->palette[iters[k]];
+
+            for(r=j; r<j+step && r<y1; r++) {
+                for(c=columns[k]; c<columns[k]+step && c<x1; c++) {
+                    store_pixel(mandel_arg, c, r, color);
+                }
+            }
+        }
+    }
+}
+
+/*
+Write rows y0 to y1-1 once every tile across them is done, with the rows
+mirrored from them, which are finished by then too: to the stream, or for
+a mapped bitmap, back to its own file.
+*/
+
+static void write_band( struct mandel_args *mandel_arg, int y0, int y1 )
+{
+    int height = bitmap_height(mandel_arg->bm);
+    int m0 = height - y1 + 1 > mandel_arg->rows ? height - y1 + 1 : mandel_arg->rows;
+    int m1 = height - y0 + 1 < height ? height - y0 + 1 : height;
+
+    if(mandel_arg->stream) {
+        bitmap_stream_rows(mandel_arg->stream, y0, y1);
+        bitmap_stream_rows(mandel_arg->stream, m0, m1);
+    } else {
+        bitmap_flush(mandel_arg->bm, y0, y1);
+        bitmap_flush(mandel_arg->bm, m0, m1);
+    }
+}
+
+/*
+The cache key of a tile: everything its counts depend on, which is the
+kernel version, the exact coordinates of its columns and rows, and what
+setup_view put in mandel_arg->view. Returns the length of the key.
+*/
+
+static size_t tile_key( struct mandel_args *mandel_arg, int x0, int y0, int x1, int y1, char *key )
+{
+    int header[5] = { KERNEL_VERSION, mandel_arg->max, mandel_arg->trace, x1-x0, y1-y0 };
+    size_t length = 0;
+    int i,j;
+
+    memcpy(key, header, sizeof(header));
+    length += sizeof(header);
+    memcpy(key + length, mandel_arg->view, strlen(mandel_arg->view) + 1);
+    length += strlen(mandel_arg->view) + 1;
+
+    for(i=x0; i<x1; i++) {
+        double x = column_x(mandel_arg, i);
+        memcpy(key + length, &x, sizeof(x));
+        length += sizeof(x);
+    }
+    for(j=y0; j<y1; j++) {
+        double y = row_y(mandel_arg, j);
+        memcpy(key + length, &y, sizeof(y));
+        length += sizeof(y);
+    }
+
+    return length;
+}
+
+/*
+Thread pool task: compute tile number "task". Tiles are numbered row by row,
+and the ones on the right and bottom edges are clipped to the rows computed.
+*/
+
+void compute_tile( void *arg, int task, int worker )
+{
     struct mandel_args* mandel_arg = (struct mandel_args*) arg;
 
     int width = bitmap_width(mandel_arg -> bm);
-    int height = bitmap_height(mandel_arg -> bm);
-    int hmin = mandel_arg -> hmin;
-    int hmax = mandel_arg -> hmax;
+    int rows = mandel_arg->rows;
 
-    // For every pixel in the image...
+    int x0 = (task % mandel_arg->tiles_across) * TILE_SIZE;
+    int y0 = (task / mandel_arg->tiles_across) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+    int y1 = y0 + TILE_SIZE < rows ? y0 + TILE_SIZE : rows;
 
-    for(j=hmin; j<hmax; j++) {
+    if(mandel_arg->step) {
+        progressive_image(mandel_arg, x0, y0, x1, y1);
+    } else {
+        int counts[TILE_SIZE][TILE_SIZE];
+        char key[5*sizeof(int) + sizeof(mandel_arg->view) + 2*TILE_SIZE*sizeof(double)];
+        size_t keylen = 0;
+        int j;
 
-        for(i=0; i<width; i++) {
+        if(mandel_arg->cache) {
+            keylen = tile_key(mandel_arg, x0, y0, x1, y1, key);
+            __sync_fetch_and_add(&mandel_arg->cache_tiles, 1);
+        }
 
-            // Determine the point in x,y space for that pixel.
-            double x = mandel_arg->xmin + i*(mandel_arg->xmax-mandel_arg->xmin)/width;
-            double y = mandel_arg->ymin + j*(mandel_arg->ymax-mandel_arg->ymin)/height;
+        if(mandel_arg->cache && cache_load(mandel_arg->cache, key, keylen, &counts[0][0], TILE_SIZE*TILE_SIZE)) {
+            __sync_fetch_and_add(&mandel_arg->cache_hits, 1);
+        } else {
+            if(mandel_arg->trace) {
+                trace_image(mandel_arg, x0, y0, x1, y1, counts);
+            } else {
+                compute_image(mandel_arg, x0, y0, x1, y1, counts);
+            }
+            if(mandel_arg->cache) {
+                cache_store(mandel_arg->cache, key, keylen, &counts[0][0], TILE_SIZE*TILE_SIZE);
+            }
+        }
 
-            // Compute the iterations at that point.
-            int iters = iterations_at_point(x,y,mandel_arg -> max);
+        // Set the pixels in the bitmap.
+        for(j=y0; j<y1; j++) {
+            store_row(mandel_arg, x0, x1, j, counts[j-y0]);
+        }
+    }
+
+    if(mandel_arg->tiles_done) {
+        int band = task / mandel_arg->tiles_across;
 
-            // Set the pixel in the bitmap.
-            bitmap_set(mandel_arg->bm,i,j,iters);
+        if(__sync_add_and_fetch(&mandel_arg->tiles_done[band], 1) == mandel_arg->tiles_across) {
+            write_band(mandel_arg, y0, y1);
         }
+    }
+}
+
+/* Thread pool task: write band number "task" of SAVE_ROWS rows. */
+
+static void save_band( void *arg, int task, int worker )
+{
+    struct bitmap_stream *stream = arg;
+    int y0 = task * SAVE_ROWS;
+
+    bitmap_stream_rows(stream, y0, y0 + SAVE_ROWS);
+}
+
+/* bitmap_save, with the rows converted and written by every thread in the pool. */
+
+static int bitmap_save_parallel( struct pool *pool, struct bitmap *bm, const char *path )
+{
+    struct bitmap_stream *stream = bitmap_stream_open(bm, path);
+    if(!stream) return 0;
+
+    pool_run(pool, (bitmap_height(bm) + SAVE_ROWS - 1) / SAVE_ROWS, save_band, stream);
 
+    return bitmap_stream_close(stream);
+}
+
+/*
+Point mandel_arg at the view of a width by height image centred on
+xstring,ystring at the given scale, choosing the number type ("auto" or a tier name) and the kernel ("auto" or
+a kernel name), and preparing them. Returns the tier, or -1 after saying
+why the view can't be rendered.
+*/
+
+static int setup_view( struct mandel_args *mandel_arg, int width, int height, const char *xstring, const char *ystring,
+                       double scale, const char *precision, const char *kernel )
+{
+    double xcenter = atof(xstring);
+    double ycenter = atof(ystring);
+
+    // Choose the number type from how far apart the pixels are.
+    int tier;
+    double spacing = 2*scale/(width > height ? width : height);
+
+    for(tier=0; tier<TIER_COUNT; tier++) {
+        if(strcmp(precision,"auto") ? !strcmp(precision,tiers[tier].name)
+                                    : tier != TIER_FLOAT && spacing >= tiers[tier].epsilon*TIER_MARGIN) break;
+    }
+    if(tier == TIER_COUNT) {
+        fprintf(stderr,"mandel: unknown number type %s\n",precision);
+        return -1;
     }
 
-    return 0;
+    // Pick the widest kernel this CPU can run, unless one was asked for.
+    escape_kernel points = kernel_select(kernel, tier == TIER_FLOAT);
+    if(!points) {
+        fprintf(stderr,"mandel: kernel %s is unknown or not supported on this CPU\n",kernel);
+        return -1;
+    }
+
+    if(tier == TIER_DD || tier == TIER_QUAD) {
+        if(!precise_center(xstring,ystring)) {
+            fprintf(stderr,"mandel: couldn't read the center %s,%s\n",xstring,ystring);
+            return -1;
+        }
+        points = tier == TIER_DD ? dd_kernel : quad_kernel;
+    }
+
+    if(tier == TIER_DEEP) {
+        if(!deep_reference(xstring,ystring,scale*M_SQRT2,mandel_arg->max)) {
+            fprintf(stderr,"mandel: couldn't compute the reference orbit at %s,%s\n",xstring,ystring);
+            return -1;
+        }
+        points = deep_kernel;
+    }
+
+    mandel_arg->kernel = points;
+
+    // Past double the points are offsets from the center, and the deep
+    // kernel's reference orbit depends on the scale too.
+    snprintf(mandel_arg->view, sizeof(mandel_arg->view), "%s %s %s %a", tiers[tier].name,
+             tier > TIER_DOUBLE ? xstring : "", tier > TIER_DOUBLE ? ystring : "",
+             tier == TIER_DEEP ? scale : 0.0);
+    mandel_arg->xmin = xcenter-scale;
+    mandel_arg->xmax = xcenter+scale;
+    mandel_arg->ymin = ycenter-scale;
+    mandel_arg->ymax = ycenter+scale;
+
+    // A view centred on the real axis is its own mirror image, so the rows
+    // below the axis can be copied from the ones above it.
+    if(mandel_arg->ymin == -mandel_arg->ymax && height > 1) {
+        mandel_arg->rows = height/2 + 1;
+    } else {
+        mandel_arg->rows = height;
+    }
+
+    // Every kernel past double takes points as offsets from the center.
+    if(tier > TIER_DOUBLE) {
+        mandel_arg->xmin = -scale;
+        mandel_arg->xmax = scale;
+        mandel_arg->ymin = -scale;
+        mandel_arg->ymax = scale;
+    }
+
+    mandel_arg->tiles_across = (width + TILE_SIZE - 1) / TILE_SIZE;
+    mandel_arg->tiles_down = (mandel_arg->rows + TILE_SIZE - 1) / TILE_SIZE;
+
+    return tier;
+}
+
+/* Name of the kernel rendering in the given tier. */
+
+static const char * view_kernel_name( struct mandel_args *mandel_arg, int tier )
+{
+    return tier <= TIER_DOUBLE ? kernel_name(mandel_arg->kernel) : tiers[tier].name;
+}
+
+/*
+Animation: render "frames" views from the start view to the end one through
+the same pool, handing each finished frame to a writer thread and rendering
+the next into a second bitmap while it is written. The scale changes by the
+same factor every frame, and the center moves in step with the zoom, so a
+zoom into the end center looks steady. The center strings are only kept
+exactly when start and end are the same point; otherwise each frame's
+center is a double, which is enough for pans, not for deep zooms.
+*/
+
+static int animate( struct pool *pool, struct mandel_args *mandel_arg, struct bitmap *bm[2], int frames,
+                    const char *xstring[2], const char *ystring[2], const double scale[2],
+                    const char *precision, const char *kernel, struct writer *writer, FILE *log )
+{
+    int frame;
+
+    for(frame=0; frame<frames; frame++) {
+        double t = frames > 1 ? (double)frame/(frames-1) : 0;
+        double s = scale[0] * pow(scale[1]/scale[0], t);
+        double u = scale[0] != scale[1] ? (scale[0]-s)/(scale[0]-scale[1]) : t;
+        char xbuffer[32], ybuffer[32];
+        const char *x = xstring[0];
+        const char *y = ystring[0];
+
+        if(strcmp(xstring[0],xstring[1])) {
+            double x0 = atof(xstring[0]);
+            snprintf(xbuffer,sizeof(xbuffer),"%.17g",x0 + (atof(xstring[1])-x0)*u);
+            x = xbuffer;
+        }
+        if(strcmp(ystring[0],ystring[1])) {
+            double y0 = atof(ystring[0]);
+            snprintf(ybuffer,sizeof(ybuffer),"%.17g",y0 + (atof(ystring[1])-y0)*u);
+            y = ybuffer;
+        }
+
+        mandel_arg->bm = bm[frame%2];
+
+        int tier = setup_view(mandel_arg,bitmap_width(mandel_arg->bm),bitmap_height(mandel_arg->bm),
+                              x,y,s,precision,kernel);
+        if(tier < 0) return 0;
+
+        fprintf(log,"mandel: frame %d x=%s y=%s scale=%lg precision=%s kernel=%s\n",
+                frame,x,y,s,tiers[tier].name,view_kernel_name(mandel_arg,tier));
+
+        pool_run(pool, mandel_arg->tiles_across * mandel_arg->tiles_down, compute_tile, mandel_arg);
+
+        if(!writer_submit(writer,mandel_arg->bm,frame)) return 0;
+    }
+
+    return 1;
+}
+
+/*
+Histogram equalization: once every count is in mandel_arg->counts, count
+how often each one occurs, a histogram per worker, respread the palette
+table over them in place, and color the image from the counts, a row per
+task.
+*/
+
+struct equalize_args {
+    struct mandel_args *args;
+    int workers;
+    long *histograms;           // one of max+1 entries per worker
+    int *palette;
+};
+
+static void count_row( void *arg, int task, int worker )
+{
+    struct equalize_args *e = arg;
+    int width = bitmap_width(e->args->bm);
+    const int *row = e->args->counts + (long)task * width;
+    long *histogram = e->histograms + (long)worker * (e->args->max + 1);
+    int height = bitmap_height(e->args->bm);
+    int mirrored = height - task >= e->args->rows && height - task < height;
+    int i;
+
+    // A row that is also mirrored counts twice, as it shows twice.
+    for(i=0; i<width; i++) {
+        histogram[row[i]] += 1 + mirrored;
+    }
+}
+
+static void color_row( void *arg, int task, int worker )
+{
+    struct equalize_args *e = arg;
+    int width = bitmap_width(e->args->bm);
+    const int *row = e->args->counts + (long)task * width;
+    int i;
+
+    for(i=0; i<width; i++) {
+        store_pixel(e->args, i, task, e->palette[row[i]]);
+    }
+}
+
+static int equalize_image( struct pool *pool, struct mandel_args *mandel_arg, const char *palette, int *table )
+{
+    struct equalize_args e;
+    int max = mandel_arg->max;
+    int i, k;
+
+    e.args = mandel_arg;
+    e.workers = pool_size(pool);
+    e.histograms = calloc((size_t)e.workers * (max + 1), sizeof(long));
+    e.palette = table;
+    if(!e.histograms) return 0;
+
+    pool_run(pool, mandel_arg->rows, count_row, &e);
+
+    // Add the other workers' histograms into the first.
+    for(k=1; k<e.workers; k++) {
+        for(i=0; i<=max; i++) {
+            e.histograms[i] += e.histograms[(long)k * (max + 1) + i];
+        }
+    }
+    palette_equalize(e.palette, palette, max, e.histograms);
+
+    pool_run(pool, mandel_arg->rows, color_row, &e);
+
+    free(e.histograms);
+    return 1;
+}
+
+/*
+Adaptive supersampling. Once the image is colored, a pixel whose color
+differs from one of its four neighbours by more than the threshold in any
+channel is on an edge, and gets the average color of an n by n grid of
+points spread over the pixel's square, centred on its own point.
+
+The edges are all found first, into a mask, so that no tile looks at a
+neighbour another tile has already smoothed. Both passes go tile by tile,
+and each edge pixel's grid goes to the kernel in one call.
+*/
+
+// Largest grid, in points across.
+#define SUPERSAMPLE_MAX 8
+
+struct supersample_args {
+    struct mandel_args *args;
+    int n;                      // points across the grid
+    int threshold;
+    unsigned char *edges;       // which pixels to supersample, width by rows
+};
+
+// Values in the edge mask: the pixel and its mirror image are on an edge, or
+// only the pixel is.
+#define EDGE_MIRRORED 1
+#define EDGE_ONLY     2
+
+static int colors_differ( int a, int b, int threshold )
+{
+    return abs(GET_RED(a) - GET_RED(b)) > threshold ||
+           abs(GET_GREEN(a) - GET_GREEN(b)) > threshold ||
+           abs(GET_BLUE(a) - GET_BLUE(b)) > threshold;
+}
+
+static void find_edges( void *arg, int task, int worker )
+{
+    struct supersample_args *a = arg;
+    struct bitmap *bm = a->args->bm;
+    int width = bitmap_width(bm);
+    int height = bitmap_height(bm);
+    int x0 = (task % a->args->tiles_across) * TILE_SIZE;
+    int y0 = (task / a->args->tiles_across) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+    int y1 = y0 + TILE_SIZE < a->args->rows ? y0 + TILE_SIZE : a->args->rows;
+    int i,j;
+
+    for(j=y0; j<y1; j++) {
+        for(i=x0; i<x1; i++) {
+            int color = bitmap_get(bm,i,j);
+            int across = (i > 0       && colors_differ(color, bitmap_get(bm,i-1,j), a->threshold)) ||
+                         (i < width-1 && colors_differ(color, bitmap_get(bm,i+1,j), a->threshold));
+            int below  = j > 0        && colors_differ(color, bitmap_get(bm,i,j-1), a->threshold);
+            int above  = j < height-1 && colors_differ(color, bitmap_get(bm,i,j+1), a->threshold);
+
+            // The mirror of row j has the mirrors of rows j+1 and j-1 on
+            // either side, except that row 1's is the top row, with nothing
+            // past it to mirror row 0.
+            if(across || above || (below && j != 1)) {
+                a->edges[(long)j*width + i] = EDGE_MIRRORED;
+            } else {
+                a->edges[(long)j*width + i] = below ? EDGE_ONLY : 0;
+            }
+        }
+    }
+}
+
+static void supersample_tile( void *arg, int task, int worker )
+{
+    struct supersample_args *a = arg;
+    struct mandel_args *mandel_arg = a->args;
+    int width = bitmap_width(mandel_arg->bm);
+    int height = bitmap_height(mandel_arg->bm);
+    int x0 = (task % mandel_arg->tiles_across) * TILE_SIZE;
+    int y0 = (task / mandel_arg->tiles_across) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+    int y1 = y0 + TILE_SIZE < mandel_arg->rows ? y0 + TILE_SIZE : mandel_arg->rows;
+    int n = a->n;
+    double dx = (mandel_arg->xmax - mandel_arg->xmin) / width;
+    double dy = (mandel_arg->ymax - mandel_arg->ymin) / height;
+    double xs[SUPERSAMPLE_MAX*SUPERSAMPLE_MAX];
+    double ys[SUPERSAMPLE_MAX*SUPERSAMPLE_MAX];
+    int iters[SUPERSAMPLE_MAX*SUPERSAMPLE_MAX];
+    int i,j,k,u,v;
+
+    for(j=y0; j<y1; j++) {
+        for(i=x0; i<x1; i++) {
+            if(!a->edges[(long)j*width + i]) continue;
+
+            double x = column_x(mandel_arg, i);
+            double y = row_y(mandel_arg, j);
+            int r = 0, g = 0, b = 0;
+
+            for(v=0; v<n; v++) {
+                for(u=0; u<n; u++) {
+                    // Offsets from the center in whole steps, so a mirrored
+                    // pixel's grid is the exact mirror image of this one.
+                    xs[v*n + u] = x + (2*u + 1 - n) * dx / (2*n);
+                    ys[v*n + u] = y + (2*v + 1 - n) * dy / (2*n);
+                }
+            }
+
+            run_kernel(mandel_arg, xs, ys, n*n, iters);
+
+            for(k=0; k<n*n; k++) {
+                int color = mandel_arg->palette[iters[k]];
+                r += GET_RED(color);
+                g += GET_GREEN(color);
+                b += GET_BLUE(color);
+            }
+            k = n*n;
+            if(a->edges[(long)j*width + i] == EDGE_MIRRORED) {
+                store_pixel(mandel_arg, i, j, MAKE_RGBA((r + k/2) / k, (g + k/2) / k, (b + k/2) / k, 0));
+            } else {
+                bitmap_set(mandel_arg->bm, i, j, MAKE_RGBA((r + k/2) / k, (g + k/2) / k, (b + k/2) / k, 0));
+            }
+        }
+    }
+}
+
+/* Returns 0 if there is no memory for the mask. */
+
+static int supersample_image( struct pool *pool, struct mandel_args *mandel_arg, int n, int threshold, long *edges )
+{
+    struct supersample_args a;
+    int width = bitmap_width(mandel_arg->bm);
+    long k, total = (long)width * mandel_arg->rows;
+    int tiles = mandel_arg->tiles_across * mandel_arg->tiles_down;
+
+    a.args = mandel_arg;
+    a.n = n;
+    a.threshold = threshold;
+    a.edges = malloc(total);
+    if(!a.edges) return 0;
+
+    pool_run(pool, tiles, find_edges, &a);
+
+    *edges = 0;
+    for(k=0; k<total; k++) {
+        *edges += a.edges[k] != 0;
+    }
+
+    pool_run(pool, tiles, supersample_tile, &a);
+
+    free(a.edges);
+    return 1;
 }
 
+/* Microseconds from since to until. */
+
+static long elapsed_us( const struct timespec *since, const struct timespec *until )
+{
+    return (until->tv_sec - since->tv_sec) * 1000000L + (until->tv_nsec - since->tv_nsec) / 1000;
+}
+
+/* Say how much the cache saved, and cut it back to its size. */
+
+static void close_cache( struct mandel_args *mandel_arg, FILE *log )
+{
+    if(!mandel_arg->cache) return;
+
+    fprintf(log,"mandel: %ld of %ld tiles came from the cache\n",mandel_arg->cache_hits,mandel_arg->cache_tiles);
+    cache_close(mandel_arg->cache);
+    mandel_arg->cache = 0;
+}
+
+/*
+Pyramid: render the image one band of PYRAMID_TILE rows at a time, from the
+top, into mandel_arg's bitmap, and hand each band to the pyramid, so the
+whole image is never held at once. Each band is a view of just its rows,
+with nothing mirrored.
+*/
+
+static int render_pyramid( struct pool *pool, struct mandel_args *mandel_arg, int width, int height, const char *manifest )
+{
+    double ymin = mandel_arg->ymin;
+    double dy = (mandel_arg->ymax - mandel_arg->ymin) / height;
+    struct bitmap *band = mandel_arg->bm;
+    struct bitmap *last = 0;
+    int top, ok = 1;
+
+    struct pyramid *pyramid = pyramid_create(manifest, width, height, pool);
+    if(!pyramid) return 0;
+
+    for(top=0; top<height && ok; top+=PYRAMID_TILE) {
+        int rows = height - top < PYRAMID_TILE ? height - top : PYRAMID_TILE;
+
+        // Only the last band can be shorter.
+        if(rows < bitmap_height(mandel_arg->bm)) {
+            last = mandel_arg->bm = bitmap_create(width, rows);
+            if(!last) break;
+        }
+
+        // Bitmap row j of the band is row height-top-rows+j of the image.
+        mandel_arg->ymin = ymin + (height - top - rows) * dy;
+        mandel_arg->ymax = mandel_arg->ymin + rows * dy;
+        mandel_arg->rows = rows;
+        mandel_arg->tiles_down = (rows + TILE_SIZE - 1) / TILE_SIZE;
+
+        pool_run(pool, mandel_arg->tiles_across * mandel_arg->tiles_down, compute_tile, mandel_arg);
+
+        ok = pyramid_add_band(pyramid, mandel_arg->bm);
+    }
+
+    if(last) bitmap_delete(last);
+    mandel_arg->bm = band;
+
+    return pyramid_finish(pyramid) && ok;
+}
 
 void show_help()
 {
@@ -73,10 +962,38 @@ void show_help()
     printf("-o <file>    Set output file. (default=mandel.bmp)\n");
     printf("-h           Show this help text.\n");
     printf("-n <threads> Number of threads to run the program.(default=1)\n");
+    printf("-k <kernel>  Escape-time kernel: auto, scalar, avx2 or avx512. (default=auto)\n");
+    printf("-b           Border tracing: fill areas whose border has one color without computing them.\n");
+    printf("-p           Progressive: save previews at 1/16 and 1/4 resolution before the full image.\n");
+    printf("-P <type>    Number type: auto, float, double, dd (double-double), quad or deep (perturbation).\n");
+    printf("             auto picks the cheapest one from double up precise enough for the scale. (default=auto)\n");
+    printf("-d           Same as -P deep.\n");
+    printf("-V           Validate the float kernel: also compute every point in double and count the differences.\n");
+    printf("-a <frames>  Render a zoom animation of this many frames, from -x/-y/-s to -X/-Y/-S.\n");
+    printf("-X <coord>   X coordinate of the center of the last frame. (default=same as -x)\n");
+    printf("-Y <coord>   Y coordinate of the center of the last frame. (default=same as -y)\n");
+    printf("-S <scale>   Scale of the last frame. (default=same as -s)\n");
+    printf("-F <format>  Animation output: bmp (one file per frame, -o is a printf pattern),\n");
+    printf("             ppm or y4m (one stream to -o, - for standard output). (default=bmp)\n");
+    printf("-r <fps>     Frame rate written in y4m streams. (default=30)\n");
+    printf("-Z           Write a deep-zoom pyramid of %dx%d tiles at every zoom level: -o names the\n",PYRAMID_TILE,PYRAMID_TILE);
+    printf("             .dzi manifest and the tiles go in the directory name_files. (default=mandel.dzi)\n");
+    printf("-C <dir>     Keep the iteration counts of every tile in this directory, and reuse them\n");
+    printf("             when a later run renders the same tile.\n");
+    printf("-c <MB>      Size the cache is cut back to at the end of a run. (default=1024)\n");
+    printf("-G <palette> Color with gray, fire or ocean. (default=gray)\n");
+    printf("-E           Spread the palette by histogram equalization, so every color covers about\n");
+    printf("             as many pixels. Together with -C, recoloring a view skips the computing.\n");
+    printf("-A <n>       Adaptive antialiasing: pixels on an edge get the average of n by n points. (2-%d)\n",SUPERSAMPLE_MAX);
+    printf("-T <diff>    A pixel is on an edge when a color channel differs by more than this\n");
+    printf("             from a neighbour's. (default=16)\n");
+    printf("-M           Render straight into the output file, mapped into memory, for images larger than memory.\n");
     printf("\nSome examples are:\n");
     printf("mandel -x -0.5 -y -0.5 -s 0.2\n");
     printf("mandel -x -.38 -y -.665 -s .05 -m 100\n");
-    printf("mandel -x 0.286932 -y 0.014287 -s .0005 -m 1000\n\n");
+    printf("mandel -x 0.286932 -y 0.014287 -s .0005 -m 1000\n");
+    printf("mandel -x -0.743643887037151 -y 0.131825904205330 -s 2 -S 1e-10 -a 600 -F y4m -o - | ffmpeg -i - zoom.mp4\n");
+    printf("mandel -x -1.74995768370609350360221450607069970727110579726252077930242837820286008082972804887218672784431700831100544507655659531379747541999999995 -y 0.00000000000000000278793706563379402178294753790944364927085054500163081379043930650189386849765202169477470552201325772332454726999999995 -s 1e-100 -m 10000\n\n");
 }
 
 int main( int argc, char *argv[] )
@@ -86,33 +1003,49 @@ int main( int argc, char *argv[] )
     // These are the default configuration values used
     // if no command line arguments are given.
 
-    const char *outfile = "mandel.bmp";
-    double xcenter = 0;
-    double ycenter = 0;
-    double scale = 4;
+    const char *outfile = 0;
+    const char *xstring[2] = { "0", 0 };    // the center as given, first and last frame
+    const char *ystring[2] = { "0", 0 };
+    double scale[2] = { 4, 0 };
     int    image_width = 500;
     int    image_height = 500;
     int    max = 1000;
     int    n = 1; //n represents number of threads.
                   //If n is not specified in the argument, it will default to 1.
+    const char *kernel = "auto";
+    int    trace = 0;
+    int    progressive = 0;
+    const char *precision = "auto";
+    int    validate = 0;
+    int    frames = 0;
+    const char *format = "bmp";
+    int    fps = 30;
+    int    mapped = 0;
+    int    pyramid = 0;
+    const char *cache = 0;
+    const char *palette = "gray";
+    int    equalize = 0;
+    int    supersample = 0;
+    int    threshold = 16;
+    long long cache_limit = 1024;
 
-    struct timeval begin_time;
-    struct timeval end_time;
+    struct timespec begin_time;
+    struct timespec compute_time;
+    struct timespec end_time;
 
-    gettimeofday( &begin_time, NULL );
     // For each command line argument given,
     // override the appropriate configuration value.
 
-    while((c = getopt(argc,argv,"x:y:s:W:H:m:o:n:h"))!=-1) {
+    while((c = getopt(argc,argv,"x:y:s:W:H:m:o:n:k:bpdP:Va:X:Y:S:F:r:MZC:c:G:EA:T:h"))!=-1) {
         switch(c) {
             case 'x':
-                    xcenter = atof(optarg);
+                    xstring[0] = optarg;
                     break;
             case 'y':
-                    ycenter = atof(optarg);
+                    ystring[0] = optarg;
                     break;
             case 's':
-                    scale = atof(optarg);
+                    scale[0] = atof(optarg);
                     break;
             case 'W':
                     image_width = atoi(optarg);
@@ -129,6 +1062,66 @@ int main( int argc, char *argv[] )
             case 'n':
                     n = atoi(optarg);
                     break;
+            case 'k':
+                    kernel = optarg;
+                    break;
+            case 'b':
+                    trace = 1;
+                    break;
+            case 'p':
+                    progressive = 1;
+                    break;
+            case 'd':
+                    precision = "deep";
+                    break;
+            case 'P':
+                    precision = optarg;
+                    break;
+            case 'V':
+                    validate = 1;
+                    break;
+            case 'a':
+                    frames = atoi(optarg);
+                    break;
+            case 'X':
+                    xstring[1] = optarg;
+                    break;
+            case 'Y':
+                    ystring[1] = optarg;
+                    break;
+            case 'S':
+                    scale[1] = atof(optarg);
+                    break;
+            case 'F':
+                    format = optarg;
+                    break;
+            case 'r':
+                    fps = atoi(optarg);
+                    break;
+            case 'M':
+                    mapped = 1;
+                    break;
+            case 'Z':
+                    pyramid = 1;
+                    break;
+            case 'C':
+                    cache = optarg;
+                    break;
+            case 'c':
+                    cache_limit = atoll(optarg);
+                    break;
+            case 'G':
+                    palette = optarg;
+                    break;
+            case 'E':
+                    equalize = 1;
+                    break;
+            case 'A':
+                    supersample = atoi(optarg);
+                    break;
+            case 'T':
+                    threshold = atoi(optarg);
+                    break;
             case 'h':
                     show_help();
                     exit(1);
@@ -136,61 +1129,265 @@ int main( int argc, char *argv[] )
         }
     }
 
+    if(trace && progressive) {
+        fprintf(stderr,"mandel: -b and -p can't be used together\n");
+        return 1;
+    }
+
+    if(frames && (progressive || validate)) {
+        fprintf(stderr,"mandel: -p and -V can't be used with -a\n");
+        return 1;
+    }
+
+    if(frames && mapped) {
+        fprintf(stderr,"mandel: -M can't be used with -a\n");
+        return 1;
+    }
+
+    if(cache && (progressive || validate)) {
+        fprintf(stderr,"mandel: -C can't be used with -p or -V\n");
+        return 1;
+    }
+
+    if(equalize && (frames || pyramid || progressive)) {
+        fprintf(stderr,"mandel: -E can't be used with -a, -Z or -p\n");
+        return 1;
+    }
+
+    if(supersample && (frames || pyramid || progressive)) {
+        fprintf(stderr,"mandel: -A can't be used with -a, -Z or -p\n");
+        return 1;
+    }
+
+    if(supersample < 0 || supersample == 1 || supersample > SUPERSAMPLE_MAX) {
+        fprintf(stderr,"mandel: -A takes 2 to %d points across\n",SUPERSAMPLE_MAX);
+        return 1;
+    }
+
+    // The color of every count, worked out once.
+    int *colors = palette_create(palette,max);
+    if(!colors) {
+        fprintf(stderr,"mandel: unknown palette %s\n",palette);
+        return 1;
+    }
+
+    if(pyramid && (frames || mapped || progressive)) {
+        fprintf(stderr,"mandel: -Z can't be used with -a, -M or -p\n");
+        free(colors);
+        return 1;
+    }
+
+    // The last frame shows the first one's view unless told otherwise.
+    if(!xstring[1]) xstring[1] = xstring[0];
+    if(!ystring[1]) ystring[1] = ystring[0];
+    if(!scale[1])   scale[1] = scale[0];
+
+    if(!outfile) {
+        if(pyramid)                    outfile = "mandel.dzi";
+        else if(!frames)               outfile = "mandel.bmp";
+        else if(!strcmp(format,"bmp")) outfile = "mandel%04d.bmp";
+        else                           outfile = "-";
+    }
+
+    // Progress goes to stderr when the frames go to stdout.
+    FILE *log = frames && !strcmp(outfile,"-") ? stderr : stdout;
+
+    // The timing covers the rendering and writing, not the options.
+    clock_gettime( CLOCK_MONOTONIC, &begin_time );
+
+    // Create a bitmap of the appropriate size, two for an animation so the
+    // next frame can be rendered while the last is written.
+    // With -M the bitmap is the output file itself, mapped into memory, so
+    // the image can be larger than memory.
+    // A pyramid is rendered a band at a time.
+    struct bitmap *bm[2];
+    if(mapped)       bm[0] = bitmap_map(image_width,image_height,outfile);
+    else if(pyramid) bm[0] = bitmap_create(image_width,image_height < PYRAMID_TILE ? image_height : PYRAMID_TILE);
+    else             bm[0] = bitmap_create(image_width,image_height);
+    bm[1] = frames ? bitmap_create(image_width,image_height) : 0;
+    if(!bm[0] || (frames && !bm[1])) {
+        fprintf(stderr,"mandel: couldn't make a %dx%d image: %s\n",image_width,image_height,strerror(errno));
+        return 1;
+    }
+
+    // Fill it with a dark blue, for debugging. A mapped file is left
+    // alone, so that every page is written only once.
+    if(!mapped) bitmap_reset(bm[0],MAKE_RGBA(0,0,255,0));
+    if(bm[1]) bitmap_reset(bm[1],MAKE_RGBA(0,0,255,0));
+
+    // Start n worker threads. Each one renders small tiles from its own queue
+    // and steals tiles from the others when it runs out, so the costly tiles
+    // inside the set are spread over all threads.
+    struct pool *pool = pool_create(n);
+
+    struct mandel_args mandel_arg;
+    mandel_arg.bm = bm[0];
+    mandel_arg.max = max;
+    mandel_arg.reference = 0;
+    mandel_arg.checked = 0;
+    mandel_arg.differ = 0;
+    mandel_arg.iterations = 0;
+    mandel_arg.trace = trace;
+    mandel_arg.step = 0;
+    mandel_arg.stream = 0;
+    mandel_arg.tiles_done = 0;
+    mandel_arg.palette = colors;
+    mandel_arg.counts = 0;
+    mandel_arg.cache_hits = 0;
+    mandel_arg.cache_tiles = 0;
+    mandel_arg.cache = cache ? cache_open(cache, cache_limit << 20) : 0;
+    if(cache && !mandel_arg.cache) {
+        fprintf(stderr,"mandel: couldn't use %s as a cache: %s\n",cache,strerror(errno));
+        return 1;
+    }
+
+    if(frames) {
+        fprintf(log,"mandel: %d frames from x=%s y=%s scale=%lg to x=%s y=%s scale=%lg max=%d outfile=%s format=%s numberofthreads=%d\n",
+                frames,xstring[0],ystring[0],scale[0],xstring[1],ystring[1],scale[1],max,outfile,format,n);
+
+        struct writer *writer = writer_create(format,outfile,image_width,image_height,fps);
+        if(!writer) {
+            fprintf(stderr,"mandel: couldn't write %s frames to %s\n",format,outfile);
+            return 1;
+        }
+
+        int ok = animate(pool,&mandel_arg,bm,frames,xstring,ystring,scale,precision,kernel,writer,log);
+        if(!writer_finish(writer) || !ok) {
+            fprintf(stderr,"mandel: the animation stopped at an error\n");
+            return 1;
+        }
+
+        pool_destroy(pool);
+        deep_release();
+        close_cache(&mandel_arg,log);
+        bitmap_delete(bm[0]);
+        bitmap_delete(bm[1]);
+        free(colors);
+        return 0;
+    }
+
+    // Validating is about the float kernels, so that's what auto means with -V.
+    if(validate && !strcmp(precision,"auto")) precision = "float";
+
+    int tier = setup_view(&mandel_arg,image_width,image_height,xstring[0],ystring[0],scale[0],precision,kernel);
+    if(tier < 0) return 1;
+
+    if(validate && tier != TIER_FLOAT) {
+        fprintf(stderr,"mandel: -V checks the float kernels, but this image is rendered in %s (add -P float to check it anyway)\n",tiers[tier].name);
+        return 1;
+    }
+    mandel_arg.reference = validate ? kernel_select(kernel, 0) : 0;
+
     // Display the configuration of the image.
-    printf("mandel: x=%lf y=%lf scale=%lf max=%d outfile=%s numberofthreads=%d\n" ,
-    xcenter,ycenter,scale,max,outfile,n);
-
-    // Create a bitmap of the appropriate size.
-    struct bitmap *bm = bitmap_create(image_width,image_height);
-
-    // Fill it with a dark blue, for debugging
-    bitmap_reset(bm,MAKE_RGBA(0,0,255,0));
-    
-    // Create n number of threads to divide the process to each thread
-	pthread_t* tid = malloc(n * sizeof(pthread_t));
-
-    // Calculate average height of each part that the image can be divided to
-    int avg_height = image_height / n;
-
-    // Loop to assign each thread to compute part of the Mandelbrot image.
-	int i;
-    struct mandel_args* mandel_arg = malloc(n * sizeof(struct mandel_args));
-
-	for(i=0; i<n; i++) {
-		mandel_arg[i].bm = bm;
-		mandel_arg[i].xmin = xcenter-scale;
-		mandel_arg[i].xmax = xcenter+scale;
-		mandel_arg[i].ymin = ycenter-scale;
-		mandel_arg[i].ymax = ycenter+scale;
-		mandel_arg[i].max = max;
-		if(i == 0){
-			mandel_arg[i].hmin = 0;
-			mandel_arg[i].hmax = avg_height;
-		}
-        else{
-			mandel_arg[i].hmin = mandel_arg[i-1].hmax;
-			mandel_arg[i].hmax= mandel_arg[i-1].hmax + avg_height;			
-		}
-        
-		pthread_create(&tid[i], NULL, compute_image, (void*) &mandel_arg[i]);
-
-	}
-
-	for(i = 0; i < n; ++i) {
-		pthread_join(tid[i], NULL);
-	}
-
-    // Save the image in the stated file.
-    if(!bitmap_save(mandel_arg->bm,outfile)) {
+    printf("mandel: x=%lf y=%lf scale=%lg max=%d outfile=%s numberofthreads=%d precision=%s kernel=%s\n" ,
+    atof(xstring[0]),atof(ystring[0]),scale[0],max,outfile,n,tiers[tier].name,view_kernel_name(&mandel_arg,tier));
+    if(tier == TIER_DEEP) {
+        printf("mandel: reference orbit of %d iterations, series skips %d\n",
+               deep_orbit_length(),deep_series_skip());
+    }
+
+    if(pyramid) {
+        int ok = render_pyramid(pool,&mandel_arg,image_width,image_height,outfile);
+
+        pool_destroy(pool);
+        deep_release();
+        close_cache(&mandel_arg,log);
+        bitmap_delete(bm[0]);
+        free(colors);
+        if(!ok) {
+            fprintf(stderr,"mandel: couldn't write the tiles for %s: %s\n",outfile,strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    if(progressive) {
+        // Save a preview after every pass but the last, which is saved below.
+        for(mandel_arg.step=PROGRESSIVE_STEP; mandel_arg.step>1; mandel_arg.step/=2) {
+            pool_run(pool, mandel_arg.tiles_across * mandel_arg.tiles_down, compute_tile, &mandel_arg);
+
+            // A mapped bitmap is the file already.
+            if(mapped ? !bitmap_sync(bm[0]) : !bitmap_save_parallel(pool,bm[0],outfile)) {
+                fprintf(stderr,"mandel: couldn't write to %s: %s\n",outfile,strerror(errno));
+                return 1;
+            }
+            printf("mandel: saved 1/%d resolution preview to %s\n",
+                   mandel_arg.step*mandel_arg.step,outfile);
+        }
+    }
+
+    // With -E the colors depend on every count, and with -A on the
+    // neighbours' colors, so then the image is only finished, and saved,
+    // once it has all been computed.
+    int deferred = equalize || supersample;
+
+    if(equalize) {
+        mandel_arg.counts = malloc((size_t)image_width * mandel_arg.rows * sizeof(int));
+        if(!mandel_arg.counts) {
+            fprintf(stderr,"mandel: couldn't keep the counts of a %dx%d image\n",image_width,image_height);
+            return 1;
+        }
+    }
+
+    if(!deferred) {
+        // Write each band of tiles as soon as it is finished, so the file is
+        // written while the rest of the image is still being computed.
+        mandel_arg.stream = mapped ? 0 : bitmap_stream_open(bm[0],outfile);
+        mandel_arg.tiles_done = calloc(mandel_arg.tiles_down, sizeof(int));
+        if((!mapped && !mandel_arg.stream) || !mandel_arg.tiles_done) {
+            fprintf(stderr,"mandel: couldn't write to %s: %s\n",outfile,strerror(errno));
+            return 1;
+        }
+    }
+
+    pool_run(pool, mandel_arg.tiles_across * mandel_arg.tiles_down, compute_tile, &mandel_arg);
+
+    int saved = 1;
+    if(equalize) {
+        saved = equalize_image(pool,&mandel_arg,palette,colors);
+        free(mandel_arg.counts);
+        mandel_arg.counts = 0;
+    }
+    if(supersample && saved) {
+        long edges = 0;
+
+        saved = supersample_image(pool,&mandel_arg,supersample,threshold,&edges);
+        if(saved) printf("mandel: supersampled %ld edge pixels (%.1f%%) with %dx%d points\n",edges,
+               100.0*edges/((long)image_width*mandel_arg.rows),supersample,supersample);
+    }
+    clock_gettime( CLOCK_MONOTONIC, &compute_time );
+
+    if(deferred && saved && !mapped) saved = bitmap_save_parallel(pool,bm[0],outfile);
+
+    pool_destroy(pool);
+    deep_release();
+    close_cache(&mandel_arg,log);
+    free(mandel_arg.tiles_done);
+
+    if(validate) {
+        printf("mandel: %ld of %ld points (%.3f%%) differ from the double-precision reference\n",
+               mandel_arg.differ,mandel_arg.checked,
+               mandel_arg.checked ? 100.0*mandel_arg.differ/mandel_arg.checked : 0.0);
+    }
+
+    if(mapped) saved = bitmap_sync(bm[0]) && saved;
+    if(mandel_arg.stream) saved = bitmap_stream_close(mandel_arg.stream) && saved;
+    if(!saved) {
         fprintf(stderr,"mandel: couldn't write to %s: %s\n",outfile,strerror(errno));
         return 1;
     }
+    bitmap_delete(bm[0]);
+    free(colors);
 
-    gettimeofday( &end_time, NULL );
+    clock_gettime( CLOCK_MONOTONIC, &end_time );
 
-    //Calculate time taken by all threads to render the image.
-    long time_to_execute = ( end_time.tv_sec * 1000000 + end_time.tv_sec ) - ( begin_time.tv_sec * 1000000 + begin_time.tv_usec );
-    printf("This code took %d microseconds to execute\n", time_to_execute);
+    //Calculate time taken by all threads to render the image. With the
+    //streamed output most of the writing happens during the computing;
+    //write_us is what is left after it.
+    long time_to_execute = elapsed_us( &begin_time, &end_time );
+    printf("mandel: timing compute_us=%ld write_us=%ld iterations=%ld\n",
+           elapsed_us( &begin_time, &compute_time ), elapsed_us( &compute_time, &end_time ), mandel_arg.iterations);
+    printf("This code took %ld microseconds to execute\n", time_to_execute);
 
     return 0;
 }
@@ -202,22 +1399,7 @@ in the Mandelbrot space, up to a maximum of max.
 
 int iterations_at_point( double x, double y, int max )
 {
-    double x0 = x;
-    double y0 = y;
-
-    int iter = 0;
-
-    while( (x*x + y*y <= 4) && iter < max ) {
-        double xt = x*x - y*y + x0;
-        double yt = 2*x*y + y0;
-
-        x = xt;
-        y = yt;
-
-        iter++;
-    }
-
-    return iteration_to_color(iter,max);
+    return iteration_to_color(escape_time(x,y,max),max);
 }
 
 /*
@@ -0,0 +1,88 @@
+#include "palette.h"
+#include "bitmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Each palette gives the color n/d of the way through it, in integers. */
+
+static int gray( long n, long d )
+{
+    int v = 255*n/d;
+    return MAKE_RGBA(v,v,v,0);
+}
+
+static int clamp( long v )
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static int fire( long n, long d )
+{
+    long t = 765*n/d;
+    return MAKE_RGBA(clamp(t),clamp(t-255),clamp(t-510),0);
+}
+
+static int ocean( long n, long d )
+{
+    long t = 510*n/d;
+    return MAKE_RGBA(clamp(t-255),clamp(t-255),clamp(t),0);
+}
+
+struct palette_entry {
+    const char *name;
+    int (*color)( long n, long d );
+};
+
+static const struct palette_entry palettes[] = {
+    { "gray",  gray },
+    { "fire",  fire },
+    { "ocean", ocean },
+};
+
+static const struct palette_entry * palette_find( const char *name )
+{
+    int i;
+
+    for(i=0; i<(int)(sizeof(palettes)/sizeof(palettes[0])); i++) {
+        if(!strcmp(palettes[i].name, name)) return &palettes[i];
+    }
+
+    return 0;
+}
+
+int * palette_create( const char *name, int max )
+{
+    const struct palette_entry *p = palette_find(name);
+    int *table;
+    int i;
+
+    if(!p) return 0;
+
+    table = malloc((max+1) * sizeof(int));
+    if(!table) return 0;
+
+    for(i=0; i<=max; i++) {
+        table[i] = p->color(i, max);
+    }
+
+    return table;
+}
+
+void palette_equalize( int *table, const char *name, int max, const long *histogram )
+{
+    const struct palette_entry *p = palette_find(name);
+    long total = 0, below = 0;
+    int i;
+
+    for(i=0; i<max; i++) {
+        total += histogram[i];
+    }
+    if(!p || total == 0) return;
+
+    for(i=0; i<max; i++) {
+        below += histogram[i];
+        table[i] = p->color(below, total);
+    }
+    table[max] = p->color(1, 1);
+}
@@ -0,0 +1,26 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+/*
+Palettes map iteration counts 0..max to colors through a lookup table,
+built once per image, so coloring a pixel is a single load.
+
+"gray" is the original coloring, 255*i/max. "fire" runs from black through
+red and yellow to white, "ocean" from black through blue to white.
+*/
+
+/*
+A table of max+1 colors spread evenly over the counts. Returns 0 for an
+unknown palette name.
+*/
+int * palette_create( const char *name, int max );
+
+/*
+Respread table's colors by histogram equalization: histogram[i] is how
+many points escaped after i iterations, for i below max, and each count
+gets the color as far through the palette as the share of points with a
+count up to it. Points that never escaped keep the last color.
+*/
+void  palette_equalize( int *table, const char *name, int max, const long *histogram );
+
+#endif
@@ -0,0 +1,241 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+A worker's deque holds tasks[top..bottom). The owner takes from the bottom,
+thieves take from the top, so they only meet when one task is left.
+*/
+
+struct deque {
+    pthread_mutex_t lock;
+    int *tasks;
+    int top;
+    int bottom;
+};
+
+struct pool {
+    int nthreads;
+    pthread_t *threads;
+    struct deque *deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // signalled when a new job is posted
+    pthread_cond_t done;        // signalled when the last worker finishes
+    int generation;             // bumped for every job
+    int active;                 // workers still busy with the current job
+    int shutdown;
+
+    pool_fn fn;
+    void *ctx;
+    int *storage;               // task numbers for all deques
+    int capacity;
+};
+
+struct worker_args {
+    struct pool *pool;
+    int id;
+};
+
+static int pop_bottom( struct deque *d )
+{
+    int task = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->bottom > d->top) {
+        task = d->tasks[--d->bottom];
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return task;
+}
+
+static int pop_top( struct deque *d )
+{
+    int task = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->bottom > d->top) {
+        task = d->tasks[d->top++];
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return task;
+}
+
+/*
+Try every other worker once, starting from a pseudo-random victim so idle
+workers do not all pile onto the same deque.
+*/
+
+static int steal( struct pool *p, int id, unsigned int *seed )
+{
+    int i;
+    int first = rand_r(seed) % p->nthreads;
+
+    for(i=0; i<p->nthreads; i++) {
+        int victim = (first + i) % p->nthreads;
+        if(victim == id) continue;
+
+        int task = pop_top(&p->deques[victim]);
+        if(task >= 0) return task;
+    }
+
+    return -1;
+}
+
+/*
+Tasks never create tasks, so once a worker finds every deque empty there is
+nothing left for it to do in this job.
+*/
+
+static void run_job( struct pool *p, int id, unsigned int *seed )
+{
+    for(;;) {
+        int task = pop_bottom(&p->deques[id]);
+        if(task < 0) task = steal(p, id, seed);
+        if(task < 0) break;
+
+        p->fn(p->ctx, task, id);
+    }
+}
+
+static void* worker( void *arg )
+{
+    struct worker_args *args = arg;
+    struct pool *p = args->pool;
+    int id = args->id;
+    unsigned int seed = id * 7919 + 1;
+    int seen = 0;
+
+    free(args);
+
+    for(;;) {
+        pthread_mutex_lock(&p->lock);
+        while(p->generation == seen && !p->shutdown) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        if(p->shutdown) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        run_job(p, id, &seed);
+
+        pthread_mutex_lock(&p->lock);
+        if(--p->active == 0) {
+            pthread_cond_signal(&p->done);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    return 0;
+}
+
+struct pool * pool_create( int nthreads )
+{
+    int i;
+    struct pool *p;
+
+    if(nthreads < 1) nthreads = 1;
+
+    p = calloc(1, sizeof(*p));
+    if(!p) return 0;
+
+    p->nthreads = nthreads;
+    p->threads = calloc(nthreads, sizeof(pthread_t));
+    p->deques = calloc(nthreads, sizeof(struct deque));
+    if(!p->threads || !p->deques) {
+        free(p->threads);
+        free(p->deques);
+        free(p);
+        return 0;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for(i=0; i<nthreads; i++) {
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+    }
+
+    for(i=0; i<nthreads; i++) {
+        struct worker_args *args = malloc(sizeof(*args));
+        args->pool = p;
+        args->id = i;
+        pthread_create(&p->threads[i], NULL, worker, args);
+    }
+
+    return p;
+}
+
+void pool_destroy( struct pool *p )
+{
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for(i=0; i<p->nthreads; i++) {
+        pthread_join(p->threads[i], NULL);
+        pthread_mutex_destroy(&p->deques[i].lock);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+
+    free(p->storage);
+    free(p->deques);
+    free(p->threads);
+    free(p);
+}
+
+int pool_size( struct pool *p )
+{
+    return p->nthreads;
+}
+
+void pool_run( struct pool *p, int ntasks, pool_fn fn, void *ctx )
+{
+    int i;
+
+    if(ntasks <= 0) return;
+
+    if(ntasks > p->capacity) {
+        free(p->storage);
+        p->storage = malloc(ntasks * sizeof(int));
+        p->capacity = ntasks;
+    }
+
+    // Deal the tasks out in contiguous runs, one per worker
+    for(i=0; i<ntasks; i++) {
+        p->storage[i] = i;
+    }
+    for(i=0; i<p->nthreads; i++) {
+        struct deque *d = &p->deques[i];
+        pthread_mutex_lock(&d->lock);
+        d->tasks = p->storage;
+        d->top = (long)ntasks * i / p->nthreads;
+        d->bottom = (long)ntasks * (i+1) / p->nthreads;
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->ctx = ctx;
+    p->active = p->nthreads;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+
+    while(p->active > 0) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+A persistent pool of worker threads with work stealing.
+
+pool_run hands out tasks numbered 0..ntasks-1. Each worker starts with a
+contiguous share of them in its own deque and works from the back of it;
+a worker whose deque runs dry steals from the front of another's. The
+threads are created once by pool_create and reused by every pool_run.
+*/
+
+struct pool;
+
+/* Run task number "task" on worker number "worker" (0..pool_size-1). */
+typedef void (*pool_fn)( void *ctx, int task, int worker );
+
+struct pool * pool_create( int nthreads );
+void          pool_destroy( struct pool *p );
+int           pool_size( struct pool *p );
+
+/* Run fn for every task in 0..ntasks-1 and return once all have finished. */
+void          pool_run( struct pool *p, int ntasks, pool_fn fn, void *ctx );
+
+#endif
@@ -0,0 +1,257 @@
+#include "precise.h"
+
+#include <gmp.h>
+#include <math.h>
+
+/*
+A double-double is the unevaluated sum hi + lo with |lo| at most half an
+ulp of hi. Sums use the error-free two_sum, products take the rounding
+error of hi*hi from an fma instruction, or on CPUs without one from
+Dekker's exact split product; both give the same error, so the images
+are the same. The Makefile builds this file with -ffp-contract=off: a
+fused multiply-add inside two_sum would lose exactly the error it is
+meant to catch.
+*/
+
+typedef struct {
+    double hi;
+    double lo;
+} dd;
+
+static inline dd quick_two_sum( double a, double b )
+{
+    dd r;
+    r.hi = a + b;
+    r.lo = b - (r.hi - a);
+    return r;
+}
+
+static inline dd dd_add( dd a, dd b )
+{
+    double s = a.hi + b.hi;
+    double v = s - a.hi;
+    double e = (a.hi - (s - v)) + (b.hi - v);
+
+    return quick_two_sum(s, e + a.lo + b.lo);
+}
+
+static inline dd dd_sub( dd a, dd b )
+{
+    b.hi = -b.hi;
+    b.lo = -b.lo;
+    return dd_add(a, b);
+}
+
+/* The rounding error of p = a*b. Without the target, fma is a libm call. */
+
+__attribute__((target("fma")))
+static inline double product_error_fma( double a, double b, double p )
+{
+    return fma(a, b, -p);
+}
+
+/* Split both factors into 26-bit halves, whose products are all exact. */
+
+static inline double product_error_split( double a, double b, double p )
+{
+    double ta = 134217729.0 * a;
+    double tb = 134217729.0 * b;
+    double ah = ta - (ta - a);
+    double bh = tb - (tb - b);
+    double al = a - ah;
+    double bl = b - bh;
+
+    return ((ah*bh - p) + ah*bl + al*bh) + al*bl;
+}
+
+typedef double (*product_error)( double a, double b, double p );
+
+/*
+dd_mul and dd_escape_time are always inlined, so each kernel below gets
+its own copy of the loop with the product error inlined too.
+*/
+
+static inline __attribute__((always_inline)) dd dd_mul( dd a, dd b, product_error error )
+{
+    double p = a.hi * b.hi;
+    double e = error(a.hi, b.hi, p);
+
+    return quick_two_sum(p, e + (a.hi*b.lo + a.lo*b.hi));
+}
+
+static inline dd dd_twice( dd a )
+{
+    a.hi *= 2;
+    a.lo *= 2;
+    return a;
+}
+
+static inline dd dd_from( double a )
+{
+    dd r = { a, 0 };
+    return r;
+}
+
+// Whether the CPU has fma, for dd_kernel.
+static int dd_fma;
+
+// The center, in both types.
+static dd center_x;
+static dd center_y;
+static __float128 quad_x;
+static __float128 quad_y;
+
+// Split a decimal string into three doubles that sum to it within 150 bits.
+static int split( const char *s, double parts[3] )
+{
+    mpf_t v, p;
+    int i;
+
+    mpf_init2(v, 256);
+    mpf_init2(p, 256);
+
+    if(mpf_set_str(v, s, 10)) {
+        mpf_clears(v, p, NULL);
+        return 0;
+    }
+
+    for(i=0; i<3; i++) {
+        parts[i] = mpf_get_d(v);
+        mpf_set_d(p, parts[i]);
+        mpf_sub(v, v, p);
+    }
+
+    mpf_clears(v, p, NULL);
+    return 1;
+}
+
+int precise_center( const char *x, const char *y )
+{
+    double px[3], py[3];
+
+    if(!split(x, px) || !split(y, py)) return 0;
+
+    __builtin_cpu_init();
+    dd_fma = __builtin_cpu_supports("fma");
+
+    center_x = quick_two_sum(px[0], px[1]);
+    center_y = quick_two_sum(py[0], py[1]);
+    quad_x = (__float128)px[0] + (__float128)px[1] + (__float128)px[2];
+    quad_y = (__float128)py[0] + (__float128)py[1] + (__float128)py[2];
+
+    return 1;
+}
+
+/*
+Both loops are escape_time in another type, with the same test for an
+orbit that returns exactly to a point it visited. The bound is tested on
+the leading double only; rounding there can only move an escape at
+|z| = 2 by a hair.
+*/
+
+static inline __attribute__((always_inline)) int dd_escape_time( double dx, double dy, int max, product_error error )
+{
+    dd x0 = dd_add(center_x, dd_from(dx));
+    dd y0 = dd_add(center_y, dd_from(dy));
+    dd x = x0;
+    dd y = y0;
+
+    dd sx = x;
+    dd sy = y;
+    int period = 0;
+    int limit = 2;
+
+    int iter = 0;
+
+    while( (x.hi*x.hi + y.hi*y.hi <= 4) && iter < max ) {
+        dd xt = dd_add(dd_sub(dd_mul(x, x, error), dd_mul(y, y, error)), x0);
+        dd yt = dd_add(dd_mul(dd_twice(x), y, error), y0);
+
+        x = xt;
+        y = yt;
+
+        iter++;
+
+        if(x.hi == sx.hi && x.lo == sx.lo && y.hi == sy.hi && y.lo == sy.lo) return max;
+        if(++period == limit) {
+            sx = x;
+            sy = y;
+            period = 0;
+            limit *= 2;
+        }
+    }
+
+    return iter;
+}
+
+static int quad_escape_time( double dx, double dy, int max )
+{
+    __float128 x0 = quad_x + dx;
+    __float128 y0 = quad_y + dy;
+    __float128 x = x0;
+    __float128 y = y0;
+
+    __float128 sx = x;
+    __float128 sy = y;
+    int period = 0;
+    int limit = 2;
+
+    int iter = 0;
+
+    while( ((double)x*(double)x + (double)y*(double)y <= 4) && iter < max ) {
+        __float128 xt = x*x - y*y + x0;
+        __float128 yt = 2*x*y + y0;
+
+        x = xt;
+        y = yt;
+
+        iter++;
+
+        if(x == sx && y == sy) return max;
+        if(++period == limit) {
+            sx = x;
+            sy = y;
+            period = 0;
+            limit *= 2;
+        }
+    }
+
+    return iter;
+}
+
+__attribute__((target("fma")))
+static void dd_kernel_fma( const double *dxs, const double *dys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = dd_escape_time(dxs[i], dys[i], max, product_error_fma);
+    }
+}
+
+static void dd_kernel_split( const double *dxs, const double *dys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = dd_escape_time(dxs[i], dys[i], max, product_error_split);
+    }
+}
+
+void dd_kernel( const double *dxs, const double *dys, int count, int max, int *iters )
+{
+    if(dd_fma) {
+        dd_kernel_fma(dxs, dys, count, max, iters);
+    } else {
+        dd_kernel_split(dxs, dys, count, max, iters);
+    }
+}
+
+void quad_kernel( const double *dxs, const double *dys, int count, int max, int *iters )
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        iters[i] = quad_escape_time(dxs[i], dys[i], max);
+    }
+}
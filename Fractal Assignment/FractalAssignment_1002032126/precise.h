@@ -0,0 +1,20 @@
+#ifndef PRECISE_H
+#define PRECISE_H
+
+/*
+Escape-time kernels in more precision than a double: double-double (about
+106 bits, two doubles per number) and __float128 (113 bits, in software).
+
+A double cannot hold the coordinates of a pixel in a view much smaller than
+1e-13, so like deep_kernel these take each point as a double offset from a
+center point, which precise_center sets from decimal strings and keeps in
+full precision.
+*/
+
+/* Returns 0 if x or y is not a number. */
+int  precise_center( const char *x, const char *y );
+
+void dd_kernel( const double *dxs, const double *dys, int count, int max, int *iters );
+void quad_kernel( const double *dxs, const double *dys, int count, int max, int *iters );
+
+#endif
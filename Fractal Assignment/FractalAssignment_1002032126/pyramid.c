@@ -0,0 +1,228 @@
+#include "pyramid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+struct level {
+    int width;
+    int height;
+    int bands;          // bands of PYRAMID_TILE rows in the level
+    int next;           // the band being filled
+    int rows;           // rows in it so far
+    int *band;          // its pixels, top row first
+};
+
+struct pyramid {
+    char *manifest;
+    char *files;        // the tile directory, name_files
+    int width;
+    int height;
+    struct pool *pool;
+    int nlevels;
+    struct level *levels;
+    int failed;
+
+    // What the pool tasks are working on.
+    int level;
+    int offset;
+};
+
+struct pyramid * pyramid_create( const char *manifest, int width, int height, struct pool *pool )
+{
+    struct pyramid *p = calloc(1, sizeof(*p));
+    char path[4096];
+    int k, w, h;
+
+    if(!p) return 0;
+
+    p->manifest = strdup(manifest);
+    p->files = malloc(strlen(manifest) + sizeof("_files"));
+    p->width = width;
+    p->height = height;
+    p->pool = pool;
+
+    // Levels run from 1x1 up to the image, doubling each time.
+    for(p->nlevels=1; (1L << (p->nlevels-1)) < (width > height ? width : height); p->nlevels++);
+    p->levels = calloc(p->nlevels, sizeof(struct level));
+
+    if(!p->manifest || !p->files || !p->levels) {
+        pyramid_finish(p);
+        return 0;
+    }
+
+    // name.dzi keeps its tiles in name_files.
+    strcpy(p->files, manifest);
+    k = strlen(p->files);
+    if(k > 4 && !strcmp(p->files + k - 4, ".dzi")) p->files[k-4] = 0;
+    strcat(p->files, "_files");
+
+    if(mkdir(p->files, 0777) != 0 && errno != EEXIST) {
+        pyramid_finish(p);
+        return 0;
+    }
+
+    w = width;
+    h = height;
+    for(k=p->nlevels-1; k>=0; k--) {
+        struct level *l = &p->levels[k];
+
+        l->width = w;
+        l->height = h;
+        l->bands = (h + PYRAMID_TILE - 1) / PYRAMID_TILE;
+        l->band = malloc((size_t)w * PYRAMID_TILE * sizeof(int));
+
+        snprintf(path, sizeof(path), "%s/%d", p->files, k);
+        if(!l->band || (mkdir(path, 0777) != 0 && errno != EEXIST)) {
+            pyramid_finish(p);
+            return 0;
+        }
+
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    return p;
+}
+
+/* Pool task: write tile number "task" of the current band of the current level. */
+
+static void write_tile( void *arg, int task, int worker )
+{
+    struct pyramid *p = arg;
+    struct level *l = &p->levels[p->level];
+    int x0 = task * PYRAMID_TILE;
+    int w = l->width - x0 < PYRAMID_TILE ? l->width - x0 : PYRAMID_TILE;
+    int h = l->rows;
+    char path[4096];
+    int y;
+
+    struct bitmap *tile = bitmap_create(w, h);
+    if(!tile) {
+        p->failed = 1;
+        return;
+    }
+
+    // Bitmaps keep the bottom row first.
+    for(y=0; y<h; y++) {
+        memcpy(bitmap_data(tile) + (long)(h-1-y)*w, l->band + (long)y*l->width + x0, w * sizeof(int));
+    }
+
+    snprintf(path, sizeof(path), "%s/%d/%d_%d.bmp", p->files, p->level, task, l->next);
+    if(!bitmap_save(tile, path)) p->failed = 1;
+
+    bitmap_delete(tile);
+}
+
+/*
+Pool task: make row "task" of the level above from two rows of the
+current band, averaging each 2x2 block. Blocks cut off by the right or
+bottom edge average the pixels they have.
+*/
+
+static void halve_row( void *arg, int task, int worker )
+{
+    struct pyramid *p = arg;
+    struct level *l = &p->levels[p->level];
+    struct level *up = &p->levels[p->level-1];
+    int *out = up->band + (long)(p->offset + task) * up->width;
+    int rows = 2*task + 1 < l->rows ? 2 : 1;
+    int x, dx, dy;
+
+    for(x=0; x<up->width; x++) {
+        int r = 0, g = 0, b = 0, a = 0, n = 0;
+
+        for(dy=0; dy<rows; dy++) {
+            int *in = l->band + (long)(2*task + dy) * l->width;
+
+            for(dx=0; dx<2 && 2*x + dx < l->width; dx++) {
+                int rgba = in[2*x + dx];
+                r += GET_RED(rgba);
+                g += GET_GREEN(rgba);
+                b += GET_BLUE(rgba);
+                a += GET_ALPHA(rgba);
+                n++;
+            }
+        }
+
+        out[x] = MAKE_RGBA((r + n/2) / n, (g + n/2) / n, (b + n/2) / n, (a + n/2) / n);
+    }
+}
+
+/*
+The band being filled at level k is complete: write its tiles and halve
+it into the level above, which is complete in turn once it holds two
+bands, or the last one.
+*/
+
+static void finish_band( struct pyramid *p, int k )
+{
+    struct level *l = &p->levels[k];
+
+    p->level = k;
+    pool_run(p->pool, (l->width + PYRAMID_TILE - 1) / PYRAMID_TILE, write_tile, p);
+
+    if(k > 0) {
+        struct level *up = &p->levels[k-1];
+        int last = l->next == l->bands - 1;
+
+        p->offset = (l->next % 2) * (PYRAMID_TILE / 2);
+        pool_run(p->pool, (l->rows + 1) / 2, halve_row, p);
+        up->rows = p->offset + (l->rows + 1) / 2;
+
+        if(l->next % 2 == 1 || last) finish_band(p, k-1);
+    }
+
+    l->next++;
+    l->rows = 0;
+}
+
+int pyramid_add_band( struct pyramid *p, struct bitmap *band )
+{
+    struct level *l = &p->levels[p->nlevels-1];
+    int h = bitmap_height(band);
+    int y;
+
+    for(y=0; y<h; y++) {
+        memcpy(l->band + (long)y*l->width, bitmap_data(band) + (long)(h-1-y)*l->width, l->width * sizeof(int));
+    }
+    l->rows = h;
+
+    finish_band(p, p->nlevels-1);
+
+    return !p->failed;
+}
+
+int pyramid_finish( struct pyramid *p )
+{
+    int ok = !p->failed;
+    int k;
+
+    if(p->levels && p->levels[0].next > 0) {
+        FILE *file = fopen(p->manifest, "w");
+
+        if(file) {
+            fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+            fprintf(file, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"bmp\">\n", PYRAMID_TILE);
+            fprintf(file, "  <Size Width=\"%d\" Height=\"%d\"/>\n", p->width, p->height);
+            fprintf(file, "</Image>\n");
+            if(fclose(file) != 0) ok = 0;
+        } else {
+            ok = 0;
+        }
+    } else {
+        ok = 0;
+    }
+
+    if(p->levels) {
+        for(k=0; k<p->nlevels; k++) free(p->levels[k].band);
+    }
+    free(p->levels);
+    free(p->manifest);
+    free(p->files);
+    free(p);
+
+    return ok;
+}
@@ -0,0 +1,37 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "bitmap.h"
+#include "pool.h"
+
+/*
+Deep-zoom tile pyramid output, in the Deep Zoom (.dzi) layout web viewers
+read: for a manifest "name.dzi", level k of the image is cut into tiles
+name_files/k/column_row.bmp of PYRAMID_TILE pixels square, where level 0
+is a single pixel, each level doubles the size of the one before, and the
+last is the full image.
+
+The image is handed over one band of PYRAMID_TILE rows at a time, from the
+top. Each band's tiles are written at once, and each coarser level is
+built by halving the bands below it as they come, so only one band per
+level is held in memory. The manifest is written last.
+*/
+
+#define PYRAMID_TILE 256
+
+struct pyramid;
+
+/* Returns 0 if the tile directories can't be made. */
+struct pyramid * pyramid_create( const char *manifest, int width, int height, struct pool *pool );
+
+/*
+Add the next band down: PYRAMID_TILE rows of the image, fewer for the last
+band. Halving and tile writing run on the pool. Returns 0 if a tile
+couldn't be written.
+*/
+int              pyramid_add_band( struct pyramid *p, struct bitmap *band );
+
+/* Write the manifest and free the pyramid. Returns 0 if any write failed. */
+int              pyramid_finish( struct pyramid *p );
+
+#endif
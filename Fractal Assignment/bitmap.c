@@ -1,24 +1,50 @@
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
 
 #include "bitmap.h"
 
+/*
+A bitmap either keeps its pixels in memory as RGBA ints, or, when made by
+bitmap_map, has no data and keeps them in a BMP file mapped at "map",
+as the file stores them.
+*/
+
 struct bitmap {
 	int width;
 	int height;
 	int *data;
+	unsigned char *map;
+	size_t mapsize;
+	int fd;
 };
 
+/* Bytes per scanline in the file: three per pixel, rounded up to a multiple of four. */
+
+static int bitmap_stride( struct bitmap *m )
+{
+	return (m->width*3 + 3) & ~3;
+}
+
+/* Where pixel x,y of a mapped bitmap is. */
+
+static unsigned char * bitmap_pixel( struct bitmap *m, int x, int y );
+
 struct bitmap * bitmap_create( int w, int h )
 {
 	struct bitmap *m;
 
-	m = malloc(sizeof *m);
+	m = calloc(1,sizeof *m);
 	if(!m) return 0;
 
-	m->data = malloc(w*h*sizeof(int));
+	m->data = malloc((size_t)w*h*sizeof(int));
 	if(!m->data) {
 		free(m);
 		return 0;
@@ -32,14 +58,29 @@ struct bitmap * bitmap_create( int w, int h )
 
 void bitmap_delete( struct bitmap *m )
 {
+	if(m->map) {
+		munmap(m->map,m->mapsize);
+		close(m->fd);
+	}
 	free(m->data);
 	free(m);
 }
 
 void bitmap_reset( struct bitmap *m, int value )
 {
-	int i;
-	for(i=0;i<(m->width*m->height);i++) {
+	long i, size = (long)m->width*m->height;
+	int x, y;
+
+	if(m->map) {
+		for(y=0;y<m->height;y++) {
+			for(x=0;x<m->width;x++) {
+				bitmap_set(m,x,y,value);
+			}
+		}
+		return;
+	}
+
+	for(i=0;i<size;i++) {
 		m->data[i] = value;
 	}
 }
@@ -51,7 +92,12 @@ int bitmap_get( struct bitmap *m, int x, int y )
 	while(x<0)         x+=m->width;
 	while(y<0)         y+=m->height;
 
-	return m->data[y*m->width+x];
+	if(m->map) {
+		unsigned char *p = bitmap_pixel(m,x,y);
+		return MAKE_RGBA(p[2],p[1],p[0],0);
+	}
+
+	return m->data[(long)y*m->width+x];
 }
 
 void bitmap_set( struct bitmap *m, int x, int y, int value )
@@ -61,7 +107,18 @@ void bitmap_set( struct bitmap *m, int x, int y, int value )
 	while(x<0)         x+=m->width;
 	while(y<0)         y+=m->height;
 
-	m->data[y*m->width+x] = value;
+	if(m->map) {
+		unsigned char *p = bitmap_pixel(m,x,y);
+		p[0] = GET_BLUE(value);
+		p[1] = GET_GREEN(value);
+		p[2] = GET_RED(value);
+
+		// The padding repeats the first bytes of the scanline, as bitmap_save writes it.
+		if(x==0) memcpy(p+m->width*3,p,bitmap_stride(m)-m->width*3);
+		return;
+	}
+
+	m->data[(long)y*m->width+x] = value;
 }
 
 int bitmap_width( struct bitmap *m )
@@ -99,57 +156,290 @@ struct bmp_header {
 	int	icolors;
 };
 
-int bitmap_save( struct bitmap *m, const char *path )
+/*
+The BMP header for m. The size fields are 32 bits; for an image too large
+for them they are 0, which readers take as "work it out from the width
+and height".
+*/
+
+static void bitmap_header( struct bitmap *m, struct bmp_header *header )
 {
-	FILE *file;
+	long long size = (long long)m->width*m->height*3;
+
+	memset(header,0,sizeof(*header));
+	header->magic1 = 'B';
+	header->magic2 = 'M';
+	header->size   = size <= 0x7fffffff ? size : 0;
+	header->offset = sizeof(*header);
+	header->infosize = sizeof(*header)-14;
+	header->width = m->width;
+	header->height = m->height;
+	header->planes = 1;
+	header->bits = 24;
+	header->compression = 0;
+	header->imagesize = size <= 0x7fffffff ? size : 0;
+	header->xres = 1000;
+	header->yres = 1000;
+}
+
+static unsigned char * bitmap_pixel( struct bitmap *m, int x, int y )
+{
+	return m->map + sizeof(struct bmp_header) + (size_t)y*bitmap_stride(m) + (size_t)x*3;
+}
+
+struct bitmap * bitmap_map( int w, int h, const char *path )
+{
+	struct bitmap *m;
 	struct bmp_header header;
-	int i, j;
-	unsigned char *scanline, *s;
 
-	file = fopen(path,"wb");
-	if(!file) return 0;
+	m = calloc(1,sizeof *m);
+	if(!m) return 0;
 
-	memset(&header,0,sizeof(header));
-	header.magic1 = 'B';
-	header.magic2 = 'M';
-	header.size   = m->width*m->height*3;
-	header.offset = sizeof(header);
-	header.infosize = sizeof(header)-14;
-	header.width = m->width;
-	header.height = m->height;
-	header.planes = 1;
-	header.bits = 24;
-	header.compression = 0;
-	header.imagesize = m->width*m->height*3;
-	header.xres = 1000;
-	header.yres = 1000;
-
-	fwrite(&header,1,sizeof(header),file);
-
-	/* if the scanline is not a multiple of four, round it up. */
-	int padlength = 4 - (m->width*3)%4;
-	if(padlength==4) padlength=0;
-
-	scanline = malloc(header.width*3);
-
-	for(j=0;j<m->height;j++) {
-		s = scanline;
-		for(i=0;i<m->width;i++) {
-			int rgba = bitmap_get(m,i,j);
-			*s++ = GET_BLUE(rgba);
-			*s++ = GET_GREEN(rgba);
-			*s++ = GET_RED(rgba);
-		}
-		fwrite(scanline,1,m->width*3,file);
-		fwrite(scanline,1,padlength,file);
+	m->width = w;
+	m->height = h;
+	m->mapsize = sizeof(header) + (size_t)h*bitmap_stride(m);
+
+	m->fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0666);
+	if(m->fd<0) {
+		free(m);
+		return 0;
+	}
+
+	if(ftruncate(m->fd,m->mapsize)!=0) {
+		close(m->fd);
+		free(m);
+		return 0;
+	}
+
+	m->map = mmap(0,m->mapsize,PROT_READ|PROT_WRITE,MAP_SHARED,m->fd,0);
+	if(m->map==MAP_FAILED) {
+		close(m->fd);
+		free(m);
+		return 0;
 	}
 
-	free(scanline);
+	bitmap_header(m,&header);
+	memcpy(m->map,&header,sizeof(header));
 
-	fclose(file);
+	return m;
+}
+
+void bitmap_flush( struct bitmap *m, int y0, int y1 )
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t start, end;
+
+	if(!m->map) return;
+	if(y0<0) y0 = 0;
+	if(y1>m->height) y1 = m->height;
+	if(y0>=y1) return;
+
+	start = bitmap_pixel(m,0,y0) - m->map;
+	end = bitmap_pixel(m,0,y1) - m->map;
+	start -= start%page;
+
+#ifdef __linux__
+	sync_file_range(m->fd,start,end-start,SYNC_FILE_RANGE_WRITE);
+#else
+	msync(m->map+start,end-start,MS_ASYNC);
+#endif
+
+	// The rows stay in the file; this only lets go of the pages, so the
+	// memory held stays about one band of tiles per thread.
+	madvise(m->map+start,end-start,MADV_DONTNEED);
+}
+
+int bitmap_sync( struct bitmap *m )
+{
+	if(!m->map) return 1;
+
+	return msync(m->map,m->mapsize,MS_SYNC)==0;
+}
+
+/*
+Pack n pixels into blue, green, red bytes. In memory a pixel is already
+blue, green, red, alpha, so the vector versions shuffle out every fourth
+byte. Each store is a full vector wide and runs past the bytes it packs,
+so they stop while that stays inside the n*3 bytes and leave the rest to
+the scalar loop.
+*/
+
+static void pack_pixels( const int *p, int n, unsigned char *s )
+{
+	int i;
+
+	for(i=0;i<n;i++) {
+		int rgba = p[i];
+		*s++ = GET_BLUE(rgba);
+		*s++ = GET_GREEN(rgba);
+		*s++ = GET_RED(rgba);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void pack_pixels_ssse3( const int *p, int n, unsigned char *s )
+{
+	const __m128i drop = _mm_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+	int i;
+
+	// 4 pixels make 12 bytes, and the store writes 16.
+	for(i=0;i+6<=n;i+=4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p+i));
+		_mm_storeu_si128((__m128i *)(s+i*3),_mm_shuffle_epi8(v,drop));
+	}
+	pack_pixels(p+i,n-i,s+i*3);
+}
+
+__attribute__((target("avx2")))
+static void pack_pixels_avx2( const int *p, int n, unsigned char *s )
+{
+	const __m256i drop = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+	                                      0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+	const __m256i join = _mm256_setr_epi32(0,1,2,4,5,6,3,7);
+	int i;
+
+	// Shuffles stay within 128-bit lanes, so the two 12-byte halves are
+	// then moved together. 8 pixels make 24 bytes, and the store writes 32.
+	for(i=0;i+11<=n;i+=8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p+i));
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v,drop),join);
+		_mm256_storeu_si256((__m256i *)(s+i*3),v);
+	}
+	pack_pixels_ssse3(p+i,n-i,s+i*3);
+}
+
+typedef void (*pack_fn)( const int *p, int n, unsigned char *s );
+
+static pack_fn pack_select( void )
+{
+	if(__builtin_cpu_supports("avx2"))  return pack_pixels_avx2;
+	if(__builtin_cpu_supports("ssse3")) return pack_pixels_ssse3;
+	return pack_pixels;
+}
+
+/*
+Convert row j to a BMP scanline at s. The padding at the end of the
+scanline repeats its first bytes, as the writer always has.
+*/
+
+static void bitmap_pack_row( struct bitmap *m, int j, unsigned char *s )
+{
+	static pack_fn pack;
+	int padlength = bitmap_stride(m) - m->width*3;
+
+	if(m->map) {
+		memcpy(s,bitmap_pixel(m,0,j),bitmap_stride(m));
+		return;
+	}
+
+	if(!pack) pack = pack_select();
+
+	pack(m->data + (long)j*m->width,m->width,s);
+	memcpy(s+m->width*3,s,padlength);
+}
+
+/* Rows are converted and written this many bytes at a time. */
+#define BITMAP_CHUNK (1<<20)
+
+struct bitmap_stream {
+	struct bitmap *m;
+	int fd;
+	int failed;
+};
+
+struct bitmap_stream * bitmap_stream_open( struct bitmap *m, const char *path )
+{
+	struct bitmap_stream *s;
+	struct bmp_header header;
+
+	s = malloc(sizeof *s);
+	if(!s) return 0;
+
+	s->m = m;
+	s->failed = 0;
+	s->fd = open(path,O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if(s->fd<0) {
+		free(s);
+		return 0;
+	}
+
+	bitmap_header(m,&header);
+
+	if(pwrite(s->fd,&header,sizeof(header),0)!=sizeof(header)) {
+		close(s->fd);
+		free(s);
+		return 0;
+	}
+
+	return s;
+}
+
+int bitmap_stream_rows( struct bitmap_stream *s, int y0, int y1 )
+{
+	struct bitmap *m = s->m;
+	int stride = bitmap_stride(m);
+	int chunk = BITMAP_CHUNK/stride > 0 ? BITMAP_CHUNK/stride : 1;
+	unsigned char *buffer;
+	int j, k;
+
+	if(y0<0) y0 = 0;
+	if(y1>m->height) y1 = m->height;
+	if(y0>=y1) return 1;
+	if(chunk>y1-y0) chunk = y1-y0;
+
+	buffer = malloc((size_t)chunk*stride);
+	if(!buffer) {
+		s->failed = 1;
+		return 0;
+	}
+
+	for(j=y0;j<y1;j+=chunk) {
+		int n = y1-j < chunk ? y1-j : chunk;
+		size_t length = (size_t)n*stride;
+		off_t offset = sizeof(struct bmp_header) + (off_t)j*stride;
+		size_t done = 0;
+
+		for(k=0;k<n;k++) {
+			bitmap_pack_row(m,j+k,buffer+(size_t)k*stride);
+		}
+
+		while(done<length) {
+			ssize_t r = pwrite(s->fd,buffer+done,length-done,offset+done);
+			if(r<=0) {
+				free(buffer);
+				s->failed = 1;
+				return 0;
+			}
+			done += r;
+		}
+	}
+
+	free(buffer);
 	return 1;
 }
 
+int bitmap_stream_close( struct bitmap_stream *s )
+{
+	int ok = !s->failed;
+
+	if(close(s->fd)!=0) ok = 0;
+	free(s);
+
+	return ok;
+}
+
+int bitmap_save( struct bitmap *m, const char *path )
+{
+	struct bitmap_stream *s;
+
+	s = bitmap_stream_open(m,path);
+	if(!s) return 0;
+
+	bitmap_stream_rows(s,0,m->height);
+
+	return bitmap_stream_close(s);
+}
+
 struct bitmap * bitmap( const char *path )
 {
 	FILE *file;
@@ -3,6 +3,7 @@
 #define BITMAP_H
 
 struct bitmap * bitmap_create( int w, int h );
+struct bitmap * bitmap_map( int w, int h, const char *file );
 void            bitmap_delete( struct bitmap *b );
 struct bitmap * bitmap_load( const char *file );
 int             bitmap_save( struct bitmap *b, const char *file );
@@ -14,6 +15,28 @@ int   bitmap_height( struct bitmap *b );
 void  bitmap_reset( struct bitmap *b, int value );
 int  *bitmap_data( struct bitmap *b );
 
+/*
+A bitmap made by bitmap_map is the BMP file itself, mapped into memory,
+so it can be larger than memory. bitmap_set writes straight into the file
+and bitmap_get returns alpha 0; bitmap_data returns 0. bitmap_flush starts
+writing finished rows y0 to y1-1 back in the background and lets go of
+their memory, and bitmap_sync waits for all of it, returning 0 if it
+failed. Both do nothing for other bitmaps.
+*/
+void  bitmap_flush( struct bitmap *b, int y0, int y1 );
+int   bitmap_sync( struct bitmap *b );
+
+/*
+Write a BMP a band of rows at a time, in any order and from any thread:
+open writes the header, each call to rows converts and writes rows y0 to
+y1-1 (clipped to the image) in place, and close returns 0 if any write failed.
+*/
+struct bitmap_stream;
+
+struct bitmap_stream * bitmap_stream_open( struct bitmap *b, const char *file );
+int                    bitmap_stream_rows( struct bitmap_stream *s, int y0, int y1 );
+int                    bitmap_stream_close( struct bitmap_stream *s );
+
 #ifndef MAKE_RGBA
 /** Create a 32-bit RGBA value from 8-bit red, green, blue, and alpha values */
 #define MAKE_RGBA(r,g,b,a) ( (((int)(a))<<24) | (((int)(r))<<16) | (((int)(g))<<8) | (((int)(b))<<0) )